@@ -0,0 +1,356 @@
+/*******************************************************************************
+ * Title: smallsh benchmarks
+ * Author: Jordan K Bartos
+ *
+ * Description: Times the hot paths of smallsh so that versions can be
+ *   compared. smallsh.c is compiled into this program without its main(), so
+ *   the functions that are timed are the ones the shell runs. These are timed:
+ *     1) parse - getArgs and parseArgs (with expansions) on synthetic lines
+ *        parse-cached - the same lines found in the parse cache
+ *        parse-file - every line of the file BENCH_PARSE_FILE, if it is set
+ *          (make bench sets it to the seed corpus, fuzz/corpus/commands.txt)
+ *     2) spawn-fg - running /bin/true in the foreground
+ *     3) jobs-table - adding and removing pids in the background job table
+ *     4) jobs-reap - running /bin/true in the background and reaping it, with
+ *        up to REAP_IN_FLIGHT running at once
+ *     5) startup - starting the built shell and reading its first prompt, for
+ *        ./smallsh and, if it has been built, ./smallsh-release
+ *
+ *   Each result is one tab-separated line on stdout:
+ *     bench <name> <size> <operations> <ns per operation> <operations per sec>
+ *   Anything the shell itself prints while being timed is sent to /dev/null.
+ *   BENCH_SCALE (default 1) divides the number of repetitions, and
+ *   SMALLSH_SPAWN picks the spawn mode just as it does for the shell.
+ *   make bench-baseline saves the results, and make bench-compare runs the
+ *   benchmarks again and prints each one's ns per operation beside the saved
+ *   one.
+*******************************************************************************/
+#define SMALLSH_NO_MAIN
+#include "smallsh.c"
+#include <time.h>
+
+#define REAP_IN_FLIGHT 64
+
+int benchScale = 1;
+FILE* reportFile = NULL;
+command cmd;
+
+
+/*******************************************************************************
+ *                          double nowNanoseconds()
+ * Description: reads the monotonic clock
+ * Output: the current time in nanoseconds
+*******************************************************************************/
+double nowNanoseconds() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double)now.tv_sec * 1e9 + (double)now.tv_nsec;
+}
+
+
+/*******************************************************************************
+ *                          long scaled(long n)
+ * Description: divides a repetition count by BENCH_SCALE, keeping at least one
+*******************************************************************************/
+long scaled(long n) {
+  return n / benchScale > 0 ? n / benchScale : 1;
+}
+
+
+/*******************************************************************************
+ *         void report(char* name, char* size, long operations, double ns)
+ * Description: prints one result line
+ * Input:
+ *   - name - the benchmark that was run
+ *   - size - the line or job count that was used, or "-"
+ *   - operations - how many operations were timed
+ *   - ns - the total time they took in nanoseconds
+*******************************************************************************/
+void report(char* name, char* size, long operations, double ns) {
+  fprintf(reportFile, "bench\t%s\t%s\t%ld\t%.1f\t%.0f\n", name, size,
+          operations, ns / operations, operations / (ns / 1e9));
+  fflush(reportFile);
+}
+
+
+/*******************************************************************************
+ *          void benchParse(char* name, char* line, long n)
+ * Description: tokenizes and parses the same line n times
+*******************************************************************************/
+void benchParse(char* name, char* line, long n) {
+  result status = {0, FALSE};
+  processes* procs = createProcessArray();
+  long i;
+  double start = nowNanoseconds();
+  for(i = 0; i < n; ++i) {
+    parseLine(line, &cmd, &status, procs);
+  }
+  report("parse", name, n, nowNanoseconds() - start);
+  destroyProcessArray(procs);
+}
+
+
+/*******************************************************************************
+ *                void benchParseFile(char* fileName, long n)
+ * Description: parses every line of a file, such as a collection of real
+ *   command lines, n times over
+*******************************************************************************/
+void benchParseFile(char* fileName, long n) {
+  FILE* file = fopen(fileName, "r");
+  if(file == NULL) {
+    fprintf(stderr, "cannot open %s\n", fileName);
+    return;
+  }
+
+  /* the lines are read first so that only the parse is timed */
+  char** lines = NULL;
+  long numLines = 0;
+  char* line = NULL;
+  size_t capacity = 0;
+  ssize_t length;
+  while((length = getline(&line, &capacity, file)) != -1) {
+    if(length > 0 && line[length - 1] == '\n') {
+      line[length - 1] = '\0';
+    }
+    lines = realloc(lines, sizeof(char*) * (numLines + 1));
+    assert(lines != NULL);
+    lines[numLines] = strdup(line);
+    numLines += 1;
+  }
+  free(line);
+  fclose(file);
+
+  result status = {0, FALSE};
+  processes* procs = createProcessArray();
+  long i;
+  long j;
+  double start = nowNanoseconds();
+  for(i = 0; i < n; ++i) {
+    for(j = 0; j < numLines; ++j) {
+      parseLine(lines[j], &cmd, &status, procs);
+    }
+  }
+  if(numLines > 0) {
+    report("parse-file", fileName, n * numLines, nowNanoseconds() - start);
+  }
+  destroyProcessArray(procs);
+  for(j = 0; j < numLines; ++j) {
+    free(lines[j]);
+  }
+  free(lines);
+}
+
+
+/*******************************************************************************
+ *             void benchParseCached(char* name, char* line, long n)
+ * Description: looks the same line up in the parse cache n times, the way the
+ *   shell handles a line it has parsed recently
+*******************************************************************************/
+void benchParseCached(char* name, char* line, long n) {
+  result status = {0, FALSE};
+  processes* procs = createProcessArray();
+  long i;
+  parseLine(line, &cmd, &status, procs);
+  parseCacheStore(line, &cmd, NULL);
+
+  double start = nowNanoseconds();
+  for(i = 0; i < n; ++i) {
+    parsedLine* cached = parseCacheFind(line);
+    assert(cached != NULL && cached->parsed.args != NULL);
+  }
+  report("parse-cached", name, n, nowNanoseconds() - start);
+  destroyProcessArray(procs);
+}
+
+
+/*******************************************************************************
+ *      void benchSpawn(processes* procs, long n)
+ * Description: runs /bin/true in the foreground n times
+*******************************************************************************/
+void benchSpawn(processes* procs, long n) {
+  result status = {0, FALSE};
+  long i;
+  double start = nowNanoseconds();
+  for(i = 0; i < n; ++i) {
+    parseLine("/bin/true", &cmd, &status, procs);
+    spawnProcess(&cmd, procs, &status);
+  }
+  report("spawn-fg", "-", n, nowNanoseconds() - start);
+}
+
+
+/*******************************************************************************
+ *             void benchJobTable(processes* procs, int jobs, long rounds)
+ * Description: fills the job table with made up pids and empties it again,
+ *   rounds times. Every other pid is removed first so that removals are not
+ *   always at the end of the live list.
+*******************************************************************************/
+void benchJobTable(processes* procs, int jobs, long rounds) {
+  char size[24];
+  long round;
+  int i;
+  double start = nowNanoseconds();
+  for(round = 0; round < rounds; ++round) {
+    for(i = 0; i < jobs; ++i) {
+      processesAdd(procs, 1000000 + i);
+    }
+    for(i = 0; i < jobs; i += 2) {
+      processesRemove(procs, 1000000 + i);
+    }
+    for(i = 1; i < jobs; i += 2) {
+      processesRemove(procs, 1000000 + i);
+    }
+  }
+  sprintf(size, "%d", jobs);
+  report("jobs-table", size, rounds * jobs, nowNanoseconds() - start);
+}
+
+
+/*******************************************************************************
+ *            void benchReap(processes* procs, int jobs)
+ * Description: starts jobs background /bin/true processes, no more than
+ *   REAP_IN_FLIGHT at a time, running the event loop to reap and report them
+ *   as they finish, until every one has been. Bounding the number running
+ *   keeps the large runs from timing the system's process limits instead.
+*******************************************************************************/
+void benchReap(processes* procs, int jobs) {
+  result status = {0, FALSE};
+  char size[24];
+  int started = 0;
+  double start = nowNanoseconds();
+  while(started < jobs || procs->size > 0) {
+    if(started < jobs && procs->size < REAP_IN_FLIGHT) {
+      parseLine("/bin/true &", &cmd, &status, procs);
+      spawnProcess(&cmd, procs, &status);
+      started += 1;
+      continue;
+    }
+    handleEvents(-1);
+    cleanupProcs(procs);
+  }
+  sprintf(size, "%d", jobs);
+  report("jobs-reap", size, jobs, nowNanoseconds() - start);
+}
+
+
+/*******************************************************************************
+ *             void benchStartup(char* program, long n)
+ * Description: starts program (a built smallsh) n times with -i -q, timing
+ *   each run from the spawn until its first prompt has been read. Its input is
+ *   then closed so that it exits. Nothing is timed if program does not exist.
+*******************************************************************************/
+void benchStartup(char* program, long n) {
+  char* argv[] = {program, "-i", "-q", NULL};
+  double total = 0;
+  long i;
+  if(access(program, X_OK) == -1) {
+    return;
+  }
+
+  for(i = 0; i < n; ++i) {
+    int input[2];
+    int output[2];
+    char prompt;
+    pid_t child;
+    int piped = pipe2(input, O_CLOEXEC) == 0 && pipe2(output, O_CLOEXEC) == 0;
+    assert(piped);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attributes;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, input[0], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, output[1], STDOUT_FILENO);
+    posix_spawnattr_init(&attributes);
+    posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGMASK);
+    posix_spawnattr_setsigmask(&attributes, &childSignalMask);
+
+    double start = nowNanoseconds();
+    int spawned = posix_spawn(&child, program, &actions, &attributes, argv,
+                              environ);
+    assert(spawned == 0);
+    close(input[0]);
+    close(output[1]);
+    while(read(output[0], &prompt, 1) == 1 && prompt != ':') {
+    }
+    total += nowNanoseconds() - start;
+
+    close(input[1]);
+    close(output[0]);
+    waitpid(child, NULL, 0);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attributes);
+  }
+  report("startup", program, n, total);
+}
+
+
+/*******************************************************************************
+ *                          int main()
+ * Description: runs every benchmark once
+*******************************************************************************/
+int main() {
+  char* scale = getenv("BENCH_SCALE");
+  if(scale != NULL && atoi(scale) > 0) {
+    benchScale = atoi(scale);
+  }
+
+  /* results go to the real stdout, everything the shell prints is discarded */
+  reportFile = fdopen(dup(STDOUT_FILENO), "w");
+  assert(reportFile != NULL);
+  freopen("/dev/null", "w", stdout);
+  interactive = FALSE;
+
+  processes* procs = createProcessArray();
+  initializeCommand(&cmd, INITIAL_NUMBER_ARGS);
+  setInterrupts();
+  loadSettings();
+  loadVariables();
+
+  fprintf(reportFile,
+          "bench\tname\tsize\toperations\tns_per_op\tops_per_sec\n");
+
+  benchParse("simple", "ls -la /usr/share", scaled(1000000));
+  benchParse("redirect", "sort -n < in.$$.txt > /tmp/job.$$.out &",
+             scaled(1000000));
+  benchParse("pipeline",
+             "cat access.log | grep -v 127.0.0.1 | cut -d ' ' -f 1 | sort",
+             scaled(1000000));
+  benchParse("variables", "cp ${HOME}/$USER.log $TMPDIR/log.$$.$? &",
+             scaled(1000000));
+  benchParse("long",
+             "echo a b c d e f g h i j k l m n o p q r s t u v w x y z "
+             "aa bb cc dd ee ff gg hh ii jj kk ll mm nn oo pp qq rr ss tt "
+             "uu vv ww xx yy zz $$ $$ $$ $$ aaa bbb ccc ddd eee fff ggg hhh",
+             scaled(200000));
+
+  if(getenv("BENCH_PARSE_FILE") != NULL) {
+    benchParseFile(getenv("BENCH_PARSE_FILE"), scaled(1000));
+  }
+
+  benchParseCached("redirect", "sort -n < in.$$.txt > /tmp/job.$$.out &",
+                   scaled(1000000));
+  benchParseCached("pipeline",
+                   "cat access.log | grep -v 127.0.0.1 | "
+                   "cut -d ' ' -f 1 | sort",
+                   scaled(1000000));
+
+  benchSpawn(procs, scaled(2000));
+
+  benchJobTable(procs, 10, scaled(100000));
+  benchJobTable(procs, 1000, scaled(1000));
+  benchJobTable(procs, 10000, scaled(100));
+
+  benchReap(procs, 10);
+  benchReap(procs, (int)scaled(1000));
+  benchReap(procs, (int)scaled(10000));
+
+  benchStartup("./smallsh", scaled(500));
+  benchStartup("./smallsh-release", scaled(500));
+
+  destroyPathCache();
+  destroyVariables();
+  destroyParseCache();
+  destroyCommand(&cmd);
+  destroyProcessArray(procs);
+  return 0;
+}
@@ -0,0 +1,333 @@
+/*******************************************************************************
+ * Title: smallsh baseline parser
+ * Author: Jordan K Bartos
+ *
+ * Description: getArgs and parseArgs (with the helpers they use) exactly as
+ *   they were in the first version of smallsh.c (the "baseline" commit), for
+ *   parse_difftest.c to compare the current parser against. The names have
+ *   been given a "baseline" prefix, so that this file can be compiled into
+ *   the same program as smallsh.c, and a few long lines wrapped. Nothing else
+ *   should be changed here: the point of the file is that it does not move.
+*******************************************************************************/
+#define BASELINE_MAX_WORD_LENGTH 200
+#define BASELINE_MAX_INPUT_SIZE 2052
+#define BASELINE_MAX_NUMBER_ARGS 512
+
+char baselineInputRedirectionFileName[BASELINE_MAX_WORD_LENGTH];
+char baselineOutputRedirectionFileName[BASELINE_MAX_WORD_LENGTH];
+
+int baselineBackgroundAllowed = TRUE;
+int baselineInputRedirectionFlag = 0;
+int baselineOutputRedirectionFlag = 0;
+int baselineBackgroundFlag = 0;
+
+
+/*******************************************************************************
+ *                       int baselineGetStringLength(char*)
+ * Returns the length of the string
+*******************************************************************************/
+int baselineGetStringLength(char* string) {
+  int len = 0;
+  while(string[len] != '\0') {
+    ++len;
+  }
+  return len;
+}
+
+
+/*******************************************************************************
+ *                     void baselineClearArgs(char** args)
+ * frees all the memory for dynamically allocated args
+*******************************************************************************/
+void baselineClearArgs(char** args) {
+  int i;
+  for(i = 0; i < BASELINE_MAX_NUMBER_ARGS; ++i) {
+    if(args[i] != NULL) {
+      free(args[i]);
+      args[i] = NULL;
+    }
+    args[i] = NULL;
+  }
+}
+
+
+/*******************************************************************************
+ *                   void baselineGetArgs(char*, char**)
+ * Description: takes the user input and parses it into individual words which
+ *   populate the char** args when the funcion ends
+*******************************************************************************/
+void baselineGetArgs(char* promptInput, char** args) {
+  int argsIndex = 0;
+  int promptIndex = 0;
+  int currWordIndex = 0;
+  char* currWord = malloc(sizeof(char) * BASELINE_MAX_WORD_LENGTH);
+  memset(currWord, '\0', BASELINE_MAX_WORD_LENGTH);
+
+  /* clear out args array before beginning */
+  baselineClearArgs(args);
+    
+  while( promptInput[promptIndex] != '\0') {
+    /* if the character is not white-space, add it to the current word */
+    if (promptInput[promptIndex] != ' ' && promptInput[promptIndex] != '\t') {
+      currWord[currWordIndex] = promptInput[promptIndex];
+      currWordIndex++;
+    }
+    /* else the current character is white-space and it's time to save the 
+       current word and begin a new one */
+    else {
+      /* copy the word */
+      currWord[currWordIndex] = '\0';
+      args[argsIndex] = malloc(sizeof(char) * (currWordIndex + 1));
+      assert(args[argsIndex] != NULL);
+      strcpy(args[argsIndex], currWord);
+      argsIndex += 1;
+      /* reset currWord and currWordIndex */
+      memset(currWord, '\0', BASELINE_MAX_WORD_LENGTH);
+      currWordIndex = 0;
+    }
+    promptIndex += 1;
+  }
+
+  /* get the last word */
+  currWord[currWordIndex] = '\0';
+  args[argsIndex] = malloc(sizeof(char) * (currWordIndex + 1));
+  assert(args[argsIndex] != NULL);
+  strcpy(args[argsIndex], currWord);
+
+  free(currWord);
+}
+
+
+/*******************************************************************************
+ *                 char** baselineInitializeArgs()
+ * Description: sets all pointers in args to NULL
+*******************************************************************************/
+char** baselineInitializeArgs() {
+  /* malloc space for MAX_NUMBER_ARGS in args */
+  char** args = malloc(sizeof(char*) * BASELINE_MAX_NUMBER_ARGS);
+  assert(args != NULL);
+
+  /* set each to NULL */
+  int i;
+  for(i = 0; i < BASELINE_MAX_NUMBER_ARGS; ++i) {
+    args[i] = NULL;
+  }
+  
+  return args;
+}
+
+
+/*******************************************************************************
+ *                     void baselineDestroyArgs(char**)
+ * Description: frees all memory allocated for the arguments array
+*******************************************************************************/
+void baselineDestroyArgs(char** args) {
+  baselineClearArgs(args);
+  free(args);
+  args = NULL;
+}
+
+
+/*******************************************************************************
+ *                   int baselineIsWord(char*) 
+ * Returns true if the char* is not a special argument character and if it is
+ * not null. Otherwise returns false
+*******************************************************************************/
+int baselineIsWord(char* word) {
+
+  /* if the word is empty (because either the pointer is set to null or 
+     the string is empty), return false */
+  if(word == NULL) {
+    return FALSE;
+  }
+  if(word[0] == '\0') {
+    return FALSE;
+  }
+
+  /* if the word begins with a special character, return false */
+  if(word[0] == '<' || word[0] == '>' || word[0] == '&') {
+    if(word[1] == '\0') {
+      return FALSE;
+    }
+  }
+
+  /* it must be a "word" for the purposes of our program. Return true */
+  return TRUE;
+}
+
+
+/*******************************************************************************
+ *   baselineArgsFilterDown(char** args,int actualIndex, int examineInex)
+ * Filters down the arguments to fill in the gaps left by file redirection
+ * commands and the like
+*******************************************************************************/
+void baselineArgsFilterDown(char** args, int* actualIndex, int* examineIndex) {
+  /* make sure the two arguments are not the same and that the one being
+     replaced is not null */
+  if (args[*actualIndex] != args[*examineIndex]) {
+    if (args[*actualIndex] != NULL) {
+      /* free dynamically allocated memory */
+      free(args[*actualIndex]);
+    }
+    /* perform the swap and */
+    args[*actualIndex] = args[*examineIndex];
+    args[*examineIndex] = NULL;
+  }
+  /* increment both indices */
+  *actualIndex += 1;
+  *examineIndex += 1;
+}
+
+
+/*******************************************************************************
+ *                  baselineReplaceDoubleDollars(char*)
+ * This function examines a string of characters four instances of '$$'. If '$$'
+ * is found, it is replaced with the pid of the currently running process.
+*******************************************************************************/
+void baselineReplaceDoubleDollars(char** arg) {
+  assert(arg != NULL);
+  assert(*arg != NULL);
+  int index = 0;
+  /* iterate through the list until the next index is the null terminator. Since
+     we must examine one index ahead for the double $$ */
+  while (((*arg)[index] != '\0') && ((*arg)[index + 1] != '\0')) {
+    if((*arg)[index] == '$' && (*arg)[index + 1] == '$') {
+      
+      /* get length of original arg, allocate memory for a newArg, get the pid
+         as a string */
+      int lenNewArg = baselineGetStringLength(*arg) + 20;
+      char* newArg = malloc(sizeof(char) * lenNewArg);
+      memset(newArg, '\0', lenNewArg);
+
+      char pidString[20];
+      memset(pidString, '\0', 20);
+      sprintf(pidString, "%d", getpid());
+      int pidLen = baselineGetStringLength(pidString);
+      
+      /* copy the argument up until the $$ */
+      int subIndex = 0;
+      for(subIndex = 0; subIndex < index; subIndex++) {
+        newArg[subIndex] = (*arg)[subIndex];
+      }
+
+      /* add the pid */
+      strcpy(newArg + index, pidString);
+      /* copy the rest of the arg minus the two $ characters being replaced*/
+      strcpy(newArg + index + pidLen, (*arg) + index + 2);
+
+      /* rearrange the pointers to replace old arg with new arg and free dyn
+         memory */
+      free(*arg);
+      *arg = newArg;
+      return;
+    }
+    index += 1;
+  }
+}
+
+
+/*******************************************************************************
+ *                    void baselineParseArgs(char**)
+ * Description: This function examines the list of arguments and does two things
+ *   1) Looks for special operators - such as file redirection or background
+ *      commands. In which case it sets flags and sets relevent global 
+ *      variables
+ *   2) Rearranges the arguments in args to move filter relevent commands down
+ *      torwards args[0] as the special operators and their arguments are
+ *      removed
+*******************************************************************************/
+void baselineParseArgs(char** args) {
+  int examineIndex = 0;
+  int actualIndex = 0;
+  
+  while(args[examineIndex] != NULL) {
+
+    /* if args at examine index is '<', then set file redirection input */
+    if(strcmp(args[examineIndex], "<") == 0) {
+      if(baselineIsWord(args[examineIndex + 1])) {
+        /* then examineIndex + 1 is the name of a file for file input 
+           redirection. Set the flag and save the file name*/
+        baselineInputRedirectionFlag = 1;
+        memset(baselineInputRedirectionFileName, '\0',
+               BASELINE_MAX_WORD_LENGTH);
+        strcpy(baselineInputRedirectionFileName, args[examineIndex + 1]);
+
+        /* rearrange current working indecies */
+        examineIndex += 2;
+      }
+      /* if the next argument is not a minimally valid word, then we will treat
+         this special character as a regular argument. */
+      else {
+        baselineArgsFilterDown(args, &actualIndex, &examineIndex);
+      }
+    }
+
+    /* if args at examine index is '>', then set file redirection output */
+    else if (strcmp(args[examineIndex], ">") == 0) {
+      if(baselineIsWord(args[examineIndex + 1])) {
+        /* then examineIndex + 1 is the name of a file for file output 
+           redirection. Set the flag and save the file name*/
+        baselineOutputRedirectionFlag = 1;
+        memset(baselineOutputRedirectionFileName, '\0',
+               BASELINE_MAX_WORD_LENGTH);
+        strcpy(baselineOutputRedirectionFileName, args[examineIndex + 1]);
+
+        /* rearrange current working indecies */
+        examineIndex += 2;
+      }
+      /* if the next argument is not a minimally valid word, then we will treat
+         this special character as a regular argument. */
+      else {
+        baselineArgsFilterDown(args, &actualIndex, &examineIndex);
+      }
+    }
+    /* replace && with pid number */
+    else if (strcmp(args[examineIndex], "$$") == 0) {
+      char* pidString = malloc(sizeof(char) * 12);
+      memset(pidString, '\0', 12);
+      sprintf(pidString, "%d", getpid());
+      free(args[examineIndex]);
+      args[examineIndex] = pidString;
+    }
+
+    /* if args at examine index is '&', then set background flag */
+    else if (strcmp(args[examineIndex], "&") == 0) {
+      /* if the & is the last argument, set the background flag */
+      if(args[examineIndex + 1] == NULL) {
+        baselineBackgroundFlag = TRUE;
+        if(baselineBackgroundAllowed == FALSE) {
+          baselineBackgroundFlag = FALSE;
+        }
+        examineIndex += 1;
+      }
+      /* if it isn't the last argument, treat it like a normal argument */
+      else {
+        baselineArgsFilterDown(args, &actualIndex, &examineIndex);
+      }
+    }
+
+    /* else, the current argument being analyzed should be treated as a regular
+       argument. Filter it down to its spot in args */
+    else {
+      /* search for '$$' in the string, and replace it with the pid if it is
+         there */
+      baselineReplaceDoubleDollars(&args[examineIndex]);
+      baselineArgsFilterDown(args, &actualIndex, &examineIndex);
+    }
+  }
+  if(args[actualIndex] != NULL) {
+    free(args[actualIndex]);
+  }
+  args[actualIndex] = NULL;
+}
+
+
+/*******************************************************************************
+ *                        void baselineResetFlags()
+ * resets the input, output, and background flags
+*******************************************************************************/
+void baselineResetFlags() {
+  baselineInputRedirectionFlag = 0;
+  baselineOutputRedirectionFlag = 0;
+  baselineBackgroundFlag = 0;
+}
@@ -0,0 +1,209 @@
+/*******************************************************************************
+ * Title: smallsh differential parser test
+ * Author: Jordan K Bartos
+ *
+ * Description: Parses every line of the files named on the command line (the
+ *   seed corpus, or anything else one line per command) with the current
+ *   parseLine and with the parser of the first version of smallsh, kept in
+ *   baseline_parse.c, and reports every line where they disagree about the
+ *   words, the < and > files or whether the command runs in the background.
+ *
+ *   Only lines in the language both parsers speak are compared. The others
+ *   are counted as skipped:
+ *     - lines with words the baseline did not know: |, <@, >>, 2>, 2>>, 2>&1,
+ *       or a leading time or limit
+ *     - lines with a '$' that is not part of a "$$", a word with two "$$"s
+ *       (the baseline only expanded the first) or a "$$" in a file name
+ *       after < or > (the baseline did not expand those)
+ *     - lines past the baseline's fixed sizes (a 2052 character line, 200
+ *       character words and 512 words)
+ *   The baseline made an empty word of every extra blank, so it is given the
+ *   line with runs of blanks squeezed to one and the ends trimmed, which is
+ *   what the current parser does itself.
+ *   The exit status is 1 if any line disagreed.
+*******************************************************************************/
+#define SMALLSH_NO_MAIN
+#include "../smallsh.c"
+#include "baseline_parse.c"
+
+#define MAX_REPORTED 10
+
+
+/*******************************************************************************
+ *            int squeezeLine(char* line, char* squeezed, size_t size)
+ * Description: copies line into squeezed with each run of blanks made a
+ *   single space and none at either end, and decides whether the line can be
+ *   compared (see above)
+ * Output: TRUE if it can
+*******************************************************************************/
+int squeezeLine(char* line, char* squeezed, size_t size) {
+  size_t length = 0;
+  int numWords = 0;
+  int afterRedirection = FALSE;
+  char* word = line + strspn(line, " \t");
+
+  while(*word != '\0') {
+    size_t wordLength = strcspn(word, " \t");
+    char* dollar = word;
+    int pairs = 0;
+    while((dollar = memchr(dollar, '$', word + wordLength - dollar)) != NULL) {
+      if(dollar + 1 >= word + wordLength || dollar[1] != '$') {
+        return FALSE;
+      }
+      pairs += 1;
+      dollar += 2;
+    }
+    if(pairs > 1 || (pairs > 0 && afterRedirection) ||
+       wordLength >= BASELINE_MAX_WORD_LENGTH ||
+       numWords + 2 >= BASELINE_MAX_NUMBER_ARGS ||
+       length + wordLength + 2 >= size) {
+      return FALSE;
+    }
+
+    if(numWords > 0) {
+      squeezed[length++] = ' ';
+    }
+    memcpy(squeezed + length, word, wordLength);
+    squeezed[length + wordLength] = '\0';
+    char* current = squeezed + length;
+    if(strcmp(current, "|") == 0 || strcmp(current, "<@") == 0 ||
+       strcmp(current, ">>") == 0 || strcmp(current, "2>") == 0 ||
+       strcmp(current, "2>>") == 0 || strcmp(current, "2>&1") == 0 ||
+       (numWords == 0 && (strcmp(current, "time") == 0 ||
+                          strcmp(current, "limit") == 0))) {
+      return FALSE;
+    }
+    afterRedirection = strcmp(current, "<") == 0 || strcmp(current, ">") == 0;
+    length += wordLength;
+    numWords += 1;
+
+    word += wordLength;
+    word += strspn(word, " \t");
+  }
+  squeezed[length] = '\0';
+  return numWords > 0;
+}
+
+
+/*******************************************************************************
+ *            int sameAsBaseline(command* cmd, char** baselineArgs)
+ * Description: compares the current parse with the baseline's
+ * Output: TRUE if they agree
+*******************************************************************************/
+int sameAsBaseline(command* cmd, char** baselineArgs) {
+  int i;
+  if(cmd->numStages != 1) {
+    return FALSE;
+  }
+  for(i = 0; cmd->args[i] != NULL; ++i) {
+    if(baselineArgs[i] == NULL || strcmp(cmd->args[i], baselineArgs[i]) != 0) {
+      return FALSE;
+    }
+  }
+  if(baselineArgs[i] != NULL) {
+    return FALSE;
+  }
+
+  if(cmd->inputRedirectionFlag != baselineInputRedirectionFlag ||
+     cmd->outputRedirectionFlag != baselineOutputRedirectionFlag ||
+     cmd->backgroundRequested != baselineBackgroundFlag) {
+    return FALSE;
+  }
+  if(cmd->inputRedirectionFlag &&
+     strcmp(cmd->inputRedirectionFileName,
+            baselineInputRedirectionFileName) != 0) {
+    return FALSE;
+  }
+  if(cmd->outputRedirectionFlag &&
+     strcmp(cmd->outputRedirectionFileName,
+            baselineOutputRedirectionFileName) != 0) {
+    return FALSE;
+  }
+  return TRUE;
+}
+
+
+/*******************************************************************************
+ *      void printParse(char* who, char** args, int in, char* inputFile,
+ *                      int out, char* outputFile, int background)
+ * Description: prints one parser's view of a line that was disagreed on
+*******************************************************************************/
+void printParse(char* who, char** args, int in, char* inputFile, int out,
+                char* outputFile, int background) {
+  int i;
+  printf("  %-8s", who);
+  for(i = 0; args[i] != NULL; ++i) {
+    printf(" [%s]", args[i]);
+  }
+  printf("%s%s%s%s%s\n", in ? " < " : "", in ? inputFile : "",
+         out ? " > " : "", out ? outputFile : "", background ? " &" : "");
+}
+
+
+/*******************************************************************************
+ *                   int main(int argc, char** argv)
+ * Description: compares the parsers on every line of the files named
+*******************************************************************************/
+int main(int argc, char** argv) {
+  result status = {0, FALSE};
+  processes* procs = createProcessArray();
+  command cmd;
+  char** baselineArgs = baselineInitializeArgs();
+  char squeezed[BASELINE_MAX_INPUT_SIZE];
+  long compared = 0;
+  long skipped = 0;
+  long different = 0;
+  char* line = NULL;
+  size_t capacity = 0;
+  ssize_t length;
+  int i;
+  initializeCommand(&cmd, INITIAL_NUMBER_ARGS);
+
+  for(i = 1; i < argc; ++i) {
+    FILE* file = fopen(argv[i], "r");
+    if(file == NULL) {
+      perror(argv[i]);
+      return 1;
+    }
+    while((length = getline(&line, &capacity, file)) != -1) {
+      if(length > 0 && line[length - 1] == '\n') {
+        line[length - 1] = '\0';
+      }
+      if(strlen(line) >= BASELINE_MAX_INPUT_SIZE - 4 ||
+         !squeezeLine(line, squeezed, sizeof(squeezed))) {
+        skipped += 1;
+        continue;
+      }
+
+      parseLine(line, &cmd, &status, procs);
+      baselineResetFlags();
+      baselineGetArgs(squeezed, baselineArgs);
+      baselineParseArgs(baselineArgs);
+      compared += 1;
+      if(sameAsBaseline(&cmd, baselineArgs)) {
+        continue;
+      }
+
+      different += 1;
+      if(different <= MAX_REPORTED) {
+        printf("%s: %s\n", argv[i], line);
+        printParse("current", cmd.args, cmd.inputRedirectionFlag,
+                   cmd.inputRedirectionFileName, cmd.outputRedirectionFlag,
+                   cmd.outputRedirectionFileName, cmd.backgroundRequested);
+        printParse("baseline", baselineArgs, baselineInputRedirectionFlag,
+                   baselineInputRedirectionFileName,
+                   baselineOutputRedirectionFlag,
+                   baselineOutputRedirectionFileName, baselineBackgroundFlag);
+      }
+    }
+    fclose(file);
+  }
+
+  printf("difftest: %ld lines compared, %ld skipped, %ld different\n",
+         compared, skipped, different);
+  free(line);
+  baselineDestroyArgs(baselineArgs);
+  destroyCommand(&cmd);
+  destroyProcessArray(procs);
+  return different > 0;
+}
@@ -0,0 +1,222 @@
+/*******************************************************************************
+ * Title: smallsh parser fuzz target
+ * Author: Jordan K Bartos
+ *
+ * Description: Feeds arbitrary input to parseLine, one line at a time as the
+ *   shell would see it, and checks that every parse leaves a command the rest
+ *   of the shell can rely on:
+ *     1) stageStart starts at 0 and only goes up, and every stage before the
+ *        last holds at least one word
+ *     2) the words of each stage are non-NULL up to the NULL that ends it
+ *     3) a file name is set whenever its redirection flag is, 2> (or 2>>)
+ *        and 2>&1 are never both in effect, and 2>> is only set with a file
+ *     4) copyCommand makes an identical command, and parsing the line again
+ *        gives the same command as the first time
+ *   A failed check is an assert(), so the fuzzer sees it as a crash.
+ *
+ *   smallsh.c is compiled in without its main(), as in bench.c. Built with
+ *   -DFUZZ_LIBFUZZER this is a libFuzzer target (LLVMFuzzerTestOneInput).
+ *   Otherwise it has a main() that runs each file named on the command line,
+ *   or stdin if there are none, which is how AFL runs a target and how a
+ *   corpus is replayed without clang. fuzz/corpus holds the seed inputs.
+*******************************************************************************/
+#define SMALLSH_NO_MAIN
+#include "../smallsh.c"
+#include <stdint.h>
+
+command fuzzCommand;
+command fuzzCopy;
+processes* fuzzProcs = NULL;
+result fuzzStatus = {0, FALSE};
+
+
+/*******************************************************************************
+ *                    void checkCommand(command* cmd)
+ * Description: asserts the invariants of a parsed command (1 to 3 above)
+*******************************************************************************/
+void checkCommand(command* cmd) {
+  int stage;
+  int i;
+  assert(cmd->numStages >= 1 && cmd->stageStart[0] == 0);
+
+  for(stage = 0; stage < cmd->numStages; ++stage) {
+    int start = cmd->stageStart[stage];
+    if(stage < cmd->numStages - 1) {
+      int end = cmd->stageStart[stage + 1] - 1;
+      assert(end > start);
+      for(i = start; i < end; ++i) {
+        assert(cmd->args[i] != NULL);
+      }
+      assert(cmd->args[end] == NULL);
+    }
+    else {
+      for(i = start; i < cmd->argsCapacity && cmd->args[i] != NULL; ++i) {
+      }
+      assert(i < cmd->argsCapacity);
+    }
+  }
+
+  assert(!cmd->inputRedirectionFlag || cmd->inputRedirectionFileName != NULL);
+  assert(!cmd->outputRedirectionFlag ||
+         cmd->outputRedirectionFileName != NULL);
+  assert(!cmd->errorRedirectionFlag || cmd->errorRedirectionFileName != NULL);
+  assert(!(cmd->errorRedirectionFlag && cmd->errorToOutputFlag));
+  assert(!cmd->inputSharedFlag || cmd->inputRedirectionFlag);
+  assert(!cmd->outputAppendFlag || cmd->outputRedirectionFlag);
+  assert(!cmd->errorAppendFlag || cmd->errorRedirectionFlag);
+}
+
+
+/*******************************************************************************
+ *                  int sameName(char* first, char* second)
+ * Description: compares two file names, either of which may be NULL
+*******************************************************************************/
+int sameName(char* first, char* second) {
+  if(first == NULL || second == NULL) {
+    return first == second;
+  }
+  return strcmp(first, second) == 0;
+}
+
+
+/*******************************************************************************
+ *                 int sameCommand(command* first, command* second)
+ * Description: decides whether two parsed commands have the same stages,
+ *   words, flags and file names
+*******************************************************************************/
+int sameCommand(command* first, command* second) {
+  int stage;
+  int i;
+  if(first->numStages != second->numStages) {
+    return FALSE;
+  }
+  for(stage = 0; stage < first->numStages; ++stage) {
+    if(first->stageStart[stage] != second->stageStart[stage]) {
+      return FALSE;
+    }
+    for(i = first->stageStart[stage]; first->args[i] != NULL; ++i) {
+      if(second->args[i] == NULL ||
+         strcmp(first->args[i], second->args[i]) != 0) {
+        return FALSE;
+      }
+    }
+    if(second->args[i] != NULL) {
+      return FALSE;
+    }
+  }
+
+  return first->inputRedirectionFlag == second->inputRedirectionFlag &&
+         first->outputRedirectionFlag == second->outputRedirectionFlag &&
+         first->inputSharedFlag == second->inputSharedFlag &&
+         first->outputAppendFlag == second->outputAppendFlag &&
+         first->errorRedirectionFlag == second->errorRedirectionFlag &&
+         first->errorAppendFlag == second->errorAppendFlag &&
+         first->errorToOutputFlag == second->errorToOutputFlag &&
+         first->backgroundRequested == second->backgroundRequested &&
+         first->timeFlag == second->timeFlag &&
+         first->limits.set == second->limits.set &&
+         sameName(first->inputRedirectionFileName,
+                  second->inputRedirectionFileName) &&
+         sameName(first->outputRedirectionFileName,
+                  second->outputRedirectionFileName) &&
+         sameName(first->errorRedirectionFileName,
+                  second->errorRedirectionFileName);
+}
+
+
+/*******************************************************************************
+ *        int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+ * Description: parses each line of data and checks the result. The input
+ *   ends at a '\0' just as a line of the shell's would.
+*******************************************************************************/
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  if(fuzzProcs == NULL) {
+    fuzzProcs = createProcessArray();
+    initializeCommand(&fuzzCommand, INITIAL_NUMBER_ARGS);
+    initializeCommand(&fuzzCopy, INITIAL_NUMBER_ARGS);
+  }
+
+  char* text = malloc(size + 1);
+  assert(text != NULL);
+  memcpy(text, data, size);
+  text[size] = '\0';
+
+  char* line = text;
+  while(line != NULL) {
+    char* newline = strchr(line, '\n');
+    if(newline != NULL) {
+      *newline = '\0';
+    }
+
+    parseLine(line, &fuzzCommand, &fuzzStatus, fuzzProcs);
+    checkCommand(&fuzzCommand);
+    copyCommand(&fuzzCommand, &fuzzCopy);
+    checkCommand(&fuzzCopy);
+    assert(sameCommand(&fuzzCommand, &fuzzCopy));
+    parseLine(line, &fuzzCommand, &fuzzStatus, fuzzProcs);
+    assert(sameCommand(&fuzzCommand, &fuzzCopy));
+
+    line = newline == NULL ? NULL : newline + 1;
+  }
+
+  free(text);
+  return 0;
+}
+
+
+#ifndef FUZZ_LIBFUZZER
+/*******************************************************************************
+ *                 char* readAll(int fd, size_t* size)
+ * Description: reads everything from fd
+ * Output: the bytes read, in a buffer the caller frees, and how many there
+ *   were in size
+*******************************************************************************/
+char* readAll(int fd, size_t* size) {
+  size_t capacity = 4096;
+  char* data = malloc(capacity);
+  assert(data != NULL);
+  ssize_t bytesRead;
+  *size = 0;
+  while((bytesRead = read(fd, data + *size, capacity - *size)) > 0) {
+    *size += bytesRead;
+    if(*size == capacity) {
+      capacity *= 2;
+      data = realloc(data, capacity);
+      assert(data != NULL);
+    }
+  }
+  return data;
+}
+
+
+/*******************************************************************************
+ *                   int main(int argc, char** argv)
+ * Description: runs the target on each file named, or on stdin
+*******************************************************************************/
+int main(int argc, char** argv) {
+  size_t size;
+  char* data;
+  int i;
+
+  if(argc == 1) {
+    data = readAll(STDIN_FILENO, &size);
+    LLVMFuzzerTestOneInput((uint8_t*)data, size);
+    free(data);
+    return 0;
+  }
+
+  for(i = 1; i < argc; ++i) {
+    int fd = open(argv[i], O_RDONLY);
+    if(fd == -1) {
+      perror(argv[i]);
+      return 1;
+    }
+    data = readAll(fd, &size);
+    close(fd);
+    LLVMFuzzerTestOneInput((uint8_t*)data, size);
+    free(data);
+  }
+  printf("parse-fuzz: %d inputs passed\n", argc - 1);
+  return 0;
+}
+#endif
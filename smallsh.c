@@ -3,55 +3,145 @@
  * Author: Jordan K Bartos
  * Date: November 11, 2019
  *
- * Description: This program is a very basic shell program. It has three build-
+ * Description: This program is a very basic shell program. It has these built-
  *   in commands:
  *     1) exit - terminates the shell and any child processes
  *     2) status - prints the exit status/signal of the last foreground process
  *     3) cd - changes the working directory
+ *     4) hash - lists (or with -r, empties) the remembered command locations
+ *     5) rehash - empties the remembered command locations
+ *     6) jobs-limit - limits how many background jobs run at once
+ *     7) export - passes shell variables on to the commands that are run
+ *     8) stats - shows where the shell spends its time (with SMALLSH_STATS)
+ *     9) history - lists the commands entered before, !N runs one of them again
+ *    10) echo, true, false, test, [ and printf - run inside the shell instead
+ *        of starting the programs of the same name
+ *    11) jobs, fg, bg, wait and kill - list, continue, wait for and signal
+ *        the background jobs (%N names job N)
+ *    12) place - spreads the background jobs over the CPUs or NUMA nodes
+ *    13) capture - collects the output of background jobs into log files
  *
  *   It also performs other non built-in commands either in the foreground or
  *   the background. It can also support file redirection with > and < 
- *   operators.
+ *   operators (<@ shares one copy of the file between jobs, >> appends, 2>
+ *   redirects the standard error, 2>> appends it and 2>&1 sends it to the
+ *   standard output),
+ *   and pipelines of commands joined with |. A command prefixed
+ *   with "time" reports its run time and resource use, and one prefixed with
+ *   "limit mem=SIZE cpu=N ..." runs with its resources capped. Words are
+ *   expanded before they are used: $$ is the pid of the shell, $? the exit
+ *   value of the last foreground command, $! the pid of the last background
+ *   process and $NAME or ${NAME} the value of a shell variable. NAME=value
+ *   sets one. Lines between "repeat N {", "for NAME in ... {" or
+ *   "while COMMAND {" and a "}" are run again and again.
  * 
- *   Send a SIGINT signal to the shell to terminate a foreground process, but
- *   not the shell. Send a SIGTSTP signal to the shell to disable the ability to
- *   run processes in the shell
+ *   Every command runs in a process group of its own. Send a SIGINT signal to
+ *   the shell to terminate a foreground process, but not the shell. Send a
+ *   SIGTSTP signal to the shell to disable the ability to run processes in the
+ *   background. A foreground process stopped with SIGSTOP becomes a stopped
+ *   job
  *   
 *******************************************************************************/
+/* pipe2(), F_SETPIPE_SZ, memfd_create(), file seals and CPU sets are Linux
+   extensions */
+#define _GNU_SOURCE
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sched.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <errno.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <limits.h>
+#include <time.h>
 
 /* preprocessor defines, global variables, and flags */
 #define TRUE 1
 #define FALSE 0
 
-#define ARBITRARY_MAX_WORD_LENGTH 200
-#define MAX_INPUT_SIZE 2052
-#define MAX_NUMBER_ARGS 512
+#define INITIAL_ARENA_SIZE 2048
+#define INITIAL_NUMBER_ARGS 64
 
-#define NUM_BUILT_INS 3
-#define CD_CODE 0
-#define STATUS_CODE 1
-#define EXIT_CODE 2
-#define COMMENT_CODE 3
+#define BUILTIN_TABLE_SIZE 64
+#define PARSE_CACHE_SIZE 64
+#define SHARED_INPUT_SIZE 16
+#define SHARED_INPUT_MAX_SIZE (8 * 1024 * 1024)
 
-char builtInCommands[NUM_BUILT_INS][24] = {"cd\0", "status\0", "exit\0"};
-char inputRedirectionFileName[ARBITRARY_MAX_WORD_LENGTH];
-char outputRedirectionFileName[ARBITRARY_MAX_WORD_LENGTH];
+#define SPAWN_POSIX 0
+#define SPAWN_FORK 1
+#define PLACE_NONE 0
+#define PLACE_CORES 1
+#define PLACE_NODES 2
+#define ERROR_TO_OUTPUT -2
+#define CAPTURE_OFF 0
+#define CAPTURE_FILE 1
+#define CAPTURE_JOBS 2
+#define BLOCK_REPEAT 0
+#define BLOCK_FOR 1
+#define BLOCK_WHILE 2
+
+#define DEFAULT_PATH "/bin:/usr/bin"
+
+#define COMPLETION_RING_SIZE 256
+#define INPUT_BLOCK_SIZE 4096
+#define BATCH_BLOCK_SIZE 65536
+#define OUTPUT_BUFFER_SIZE 65536
+#define MAX_EVENTS 8
+#define TRACE_BUFFER_SIZE 65536
+#define LOOKAHEAD_SIZE 16
+#define CAPTURE_CHUNK 65536
 
 int background_allowed = TRUE;
 int previous_background_allowed = TRUE;
-int inputRedirectionFlag = 0;
-int outputRedirectionFlag = 0;
-int backgroundFlag = 0;
 int foregroundProcessRunning = 0;
+int foregroundPgid = 0;
+int foregroundOwnsTerminal = FALSE;
+int foregroundStopped = 0;
+int interruptReceived = FALSE;
+int* foregroundPids = NULL;
+int foregroundCapacity = 0;
+int numForegroundPids = 0;
+int foregroundRemaining = 0;
+int foregroundResults = 0;
+struct timespec foregroundStarted;
+struct timespec foregroundEnded;
+struct rusage foregroundUsage;
+int waitingAtPrompt = FALSE;
+int interactive = TRUE;
+int quiet = FALSE;
+int spawnMode = SPAWN_POSIX;
+int pipeSize = 0;
+int devNullFd = -1;
+int timingAll = FALSE;
+char pidString[24];
+int pidStringLength = 0;
+int jobsLimit = 0;
+char* cgroupRoot = NULL;
+int cgroupJobs = 0;
+
+sigset_t childSignalMask;
+int epollFd = -1;
+int signalFd = -1;
+
+extern char** environ;
 
 
 /*******************************************************************************
@@ -97,906 +187,6902 @@ int getStringLength(char* string) {
 
 
 /*******************************************************************************
- *                  void catchSIGINT(int sigNumber)
- * Description: this function handles a SIGINT call. It prevents the termination
- *   of the shell program while child processes are killed. 
+ *                         void flushOutput()
+ * Description: writes out what the shell has printed. An interactive shell
+ *   shows each message straight away. Without a user watching, stdout is fully
+ *   buffered and only written when the shell is about to launch a child, wait
+ *   for input, or exit, so that a script does not pay a write() per message.
 *******************************************************************************/
-void catchSIGINT(int sigNumber) {
-  return;
+void flushOutput() {
+  if(interactive) {
+    fflush(stdout);
+  }
 }
 
 
 /*******************************************************************************
- *                  void shellCatchSIGTSTP(int sigNumber)
- * Description: this function handles a SIGTSTP signal received by the shell. 
- *   It prevents the termination of the shell program and prints an informative
- *   message. It also flips background_allowed to the opposite value. Either
- *   allowing or dis-allowing background execution of programs
+ *                         void printPrompt()
+ * Description: displays the prompt, if there is a user to see it
 *******************************************************************************/
-void shellCatchSIGTSTP(int sigNumber) {
-  /* flip background_allowed to opposite value */
-  background_allowed ^= 1;
-
-  /* if a foreground process is currently running, wait for it to complete
-     before printing a message */
-  char message[100];
-  memset(message, '\0', 100);
-  if(foregroundProcessRunning == TRUE) {
-    return;
-  }
-  /* if a foreground process is not currently running, print a message about
-     whether background processes are allowed immediately */
-  else if (background_allowed == 0) {
-    strcpy(message, "\nEntering foreground-only mode (& is now ignored)\n:");
-  }
-  else {
-    strcpy(message, "\nExiting foreground-only mode\n:");
+void printPrompt() {
+  if(interactive) {
+    write(STDOUT_FILENO, ":", 1);
   }
-  write(STDOUT_FILENO, message, getStringLength(message));
-  /* set the duel flags equal to eachother so that the message will not be
-     repeated by the main shell program */
-  previous_background_allowed = background_allowed;
-  return;
 }
- 
 
 
 /*******************************************************************************
- *                        struct processArray
- * This struct will hold data about the currently running background processes.
- * It functions as a dynamic array so that as many background processes as 
- * needed may be run and the program can track them all.
+ *                           shell statistics
+ * When smallsh is built with -DSMALLSH_STATS, each hot path is timed with the
+ * monotonic clock and counted in a statCounter. Besides the count, total and
+ * longest time, every counter has a histogram with one bucket per power of
+ * two nanoseconds, so recording a sample is a handful of additions with no
+ * allocation and no locking (the shell has a single thread and its signals
+ * are handled from the event loop). Without SMALLSH_STATS the STATS_ macros
+ * are empty and the default build does none of this.
 *******************************************************************************/
+#define STAT_GETARGS 0
+#define STAT_PARSE 1
+#define STAT_EXPAND 2
+#define STAT_SPAWN 3
+#define STAT_WAIT 4
+#define STAT_REAP 5
+#define STAT_CLEANUP 6
+#define NUM_STATS 7
+#define STATS_BUCKETS 40
 
-typedef struct processArray {
-  int capacity;
-  int size;
-  int * array;
-} processes;
+typedef struct StatCounter {
+  char* name;
+  unsigned long count;
+  unsigned long totalNs;
+  unsigned long maxNs;
+  unsigned long buckets[STATS_BUCKETS];
+} statCounter;
+
+statCounter statCounters[NUM_STATS] = {
+  {"getArgs"}, {"parseArgs"}, {"expandWord"}, {"spawn"}, {"wait"},
+  {"reapChildren"}, {"cleanupProcs"}
+};
+char* statsFileName = NULL;
+
+#ifdef SMALLSH_STATS
+#define STATS_BEGIN(timer) \
+  struct timespec timer; \
+  clock_gettime(CLOCK_MONOTONIC, &timer)
+#define STATS_END(counter, timer) statsRecord(counter, &timer)
+#else
+#define STATS_BEGIN(timer)
+#define STATS_END(counter, timer)
+#endif
 
 
 /*******************************************************************************
- *                       processes* createProcessArray()
- * Returns a pointer to a fully initialized processArray 
- * Input:
- *   none
- * Output:
- *   A pointer to a new processes struct that is initalized with valid data
+ *          void statsRecord(int counter, struct timespec* began)
+ * Description: adds the time since began to a counter and its histogram.
+ *   Bucket i counts the samples that took less than 2^i nanoseconds (and at
+ *   least 2^(i-1)), the last bucket also counts everything longer.
 *******************************************************************************/
-processes* createProcessArray() {
-  /* allocate a new processArray and set its member variables accordingly */
-  processes* newProcesses = malloc(sizeof(processes));
-  newProcesses->capacity = 10;
-  newProcesses->size = 0;
+void statsRecord(int counter, struct timespec* began) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  unsigned long ns = (now.tv_sec - began->tv_sec) * 1000000000UL +
+                     now.tv_nsec - began->tv_nsec;
 
-  /* allocate memory for the dynamic array and set its contents to all 0*/
-  newProcesses->array = malloc(sizeof(int) * newProcesses->capacity);
-  int i;
-  for(i = 0; i < newProcesses->capacity; ++i) {
-    newProcesses->array[i] = 0;
+  statCounter* stat = &statCounters[counter];
+  int bucket = ns == 0 ? 0 : 64 - __builtin_clzl(ns);
+  if(bucket >= STATS_BUCKETS) {
+    bucket = STATS_BUCKETS - 1;
   }
-
-  return newProcesses;
+  stat->count += 1;
+  stat->totalNs += ns;
+  if(ns > stat->maxNs) {
+    stat->maxNs = ns;
+  }
+  stat->buckets[bucket] += 1;
 }
 
 
 /*******************************************************************************
- *                       process printProcesses(processes*)
- * prints all of the pids in the processes array
- * Input:
- *   pointer to processes
- * Output:
- *   none
- *   displays current bg process ids to stdout
+ *         unsigned long statsPercentile(statCounter* stat, int percent)
+ * Description: estimates a percentile of a counter from its histogram
+ * Output: the upper bound, in nanoseconds, of the bucket the percentile falls
+ *   in, capped at the longest time seen
 *******************************************************************************/
-void printProcesses(processes* procs) {
-  int i = 0;
-  for(i = 0; i < procs->capacity; ++i) {
-    printf("procs[%d]: %d\n", i, procs->array[i]);
-    fflush(stdout);
+unsigned long statsPercentile(statCounter* stat, int percent) {
+  unsigned long wanted = (stat->count * percent + 99) / 100;
+  unsigned long seen = 0;
+  int i;
+  for(i = 0; i < STATS_BUCKETS; ++i) {
+    seen += stat->buckets[i];
+    if(seen >= wanted && seen > 0) {
+      unsigned long bound = 1UL << i;
+      return bound < stat->maxNs ? bound : stat->maxNs;
+    }
   }
+  return stat->maxNs;
 }
 
 
 /*******************************************************************************
- *                      void destroyProcessArray(proc)
- * deallocates memory for proc and sets to NULL
- * Input: 
- *   a pointer to a processes struct
- * Output: 
- *   none
+ *                              tracing
+ * With SMALLSH_TRACE=file the shell writes a timeline of everything it does to
+ * file in the Chrome trace event format, which chrome://tracing and Perfetto
+ * can open. Each event is a complete ("X") event with a start and a duration
+ * in microseconds since the shell started. The shell's own work (waiting for
+ * input, parsing, spawning, waiting, reaping) is on the shell's track and each
+ * child's lifetime is on a track of its own, so background jobs that run at
+ * the same time show up side by side. Events are collected in traceBuffer and
+ * written out with one write() whenever it fills up and when the shell exits,
+ * so that tracing adds no system calls to the commands being traced.
 *******************************************************************************/
-void destroyProcessArray(processes* procs) {
-  assert(procs != NULL);
-
-  free(procs->array);
-  free(procs);
-  procs = NULL;
-}
+int traceFd = -1;
+char* traceBuffer = NULL;
+size_t traceUsed = 0;
+struct timespec traceStarted;
 
 
 /*******************************************************************************
- *                       void doubleCapacity(processes*)
- * doubles the capacity of the dynamic array managed by the processes struct
- * Input:
- *   a pointer to a processes struct
- * Output:
- *   none
- *   doubles the capacity of the dynamic array
+ *                           void traceFlush()
+ * Description: writes out the buffered trace events
 *******************************************************************************/
-void doubleCapacity(processes* proc) {
-  /* allocate new memory for the processes array and initialize all values 
-     to 0*/
-  int* newArray = malloc(sizeof(int) * proc->capacity * 2);
-  int i;
-  for(i = 0; i < proc->capacity * 2; ++i) {
-    newArray[i] = 0;
-  }
-
-  /* copy all values from old array over to the new array */
-  for(i = 0; i < proc->capacity; ++i ) {
-    newArray[i] = proc->array[i];
+void traceFlush() {
+  size_t written = 0;
+  while(written < traceUsed) {
+    ssize_t result = write(traceFd, traceBuffer + written, traceUsed - written);
+    if(result == -1 && errno == EINTR) {
+      continue;
+    }
+    if(result <= 0) {
+      break;
+    }
+    written += result;
   }
-
-  /* deallocate old array, and reset pointer to the new array */
-  free(proc->array);
-  proc->array = newArray;
-  proc->capacity *= 2;
+  traceUsed = 0;
 }
 
 
 /*******************************************************************************
- *                   void processesAdd(processes*, int)
- * adds a pid to the processes array
- * Input:
- *   processes * proc - a pointer to a precesses struct dynamic array
- *   int val - the value (pid) to be added to the array
+ *                   void tracePrintf(char* format, ...)
+ * Description: appends formatted text to the trace buffer, writing the buffer
+ *   out first if the text does not fit
 *******************************************************************************/
-void processesAdd(processes* proc, int val) {
-  assert(proc != NULL);
-
-  int index = 0;
+void tracePrintf(char* format, ...) {
+  va_list arguments;
+  int length;
 
-  /* double the capacity if the array is maxed out */
-  if(proc->capacity == proc->size) {
-    doubleCapacity(proc);
-    /* ensure that the second half of the array is set to all 0s. I though
-       I took care of that in doubleCapacity, but now I'm afraid to change
-       this */
-    for(index = proc->size; index < proc->capacity; ++index) {
-      proc->array[index] = 0;
-    }
+  va_start(arguments, format);
+  length = vsnprintf(traceBuffer + traceUsed, TRACE_BUFFER_SIZE - traceUsed,
+                     format, arguments);
+  va_end(arguments);
+  if(length >= 0 && traceUsed + length < TRACE_BUFFER_SIZE) {
+    traceUsed += length;
+    return;
   }
 
-  /* find the next empty slot to put the new pid */
-  index = 0;
-  while(index < proc->capacity) {
-    if(proc->array[index] == 0) {
-      proc->array[index] = val;
-      proc->size += 1;
-      return;
-    }
-    index++;
+  traceFlush();
+  va_start(arguments, format);
+  length = vsnprintf(traceBuffer, TRACE_BUFFER_SIZE, format, arguments);
+  va_end(arguments);
+  if(length >= 0) {
+    traceUsed = length < TRACE_BUFFER_SIZE ? length : TRACE_BUFFER_SIZE - 1;
   }
 }
 
 
 /*******************************************************************************
- *               void processesRemove(processes*, int)
- * finds the pid in the array and removes it from the dynamic array
- * Input: 
- *   processes* proc: a poniter to a processes struct dynamic array
- *   int val - the pid of the process to be removed
+ *                     void traceString(char* string)
+ * Description: appends string to the trace as a quoted JSON string, escaping
+ *   the characters that JSON does not allow as they are
 *******************************************************************************/
-void processesRemove(processes* proc, int val) {
-  assert(proc != NULL);
-
-  /* search for the value in the array */
-  int i;
-  for(i = 0; i < proc->capacity; ++i) {
-    if(proc->array[i] == val) {
-      int j;
-      /* if it is found, filter the rest of the values down so there isn't a
-         gap in the array */
-      for(j = i + 1; j < proc->capacity; ++j) {
-        proc->array[j -1] = proc->array[j];
-      }
-      /* set the final value to 0, decrement the size and return */
-      proc->array[j - 1] = 0;
-      proc->size -= 1;
-      return;
+void traceString(char* string) {
+  tracePrintf("\"");
+  for(; *string != '\0'; ++string) {
+    unsigned char character = *string;
+    if(character == '"' || character == '\\') {
+      tracePrintf("\\%c", character);
+    }
+    else if(character < 0x20) {
+      tracePrintf("\\u%04x", character);
+    }
+    else {
+      tracePrintf("%c", character);
     }
   }
+  tracePrintf("\"");
 }
 
 
-
 /*******************************************************************************
- *                   void setInterrupts()
- * Description: sets up all the interrupts for int main()
- * This code is taken from CS344 Lectures in block 3 by Benjamin Brewster
+ *                    void traceOpen(char* fileName)
+ * Description: starts a trace in fileName. The shell's track is named after
+ *   the shell.
 *******************************************************************************/
-void setInterrupts() {
-  /* SIGINT handler */
-  /* the SIGINT handler will block all other interrupts until it is finished,
-     and system calls will restart after the handler returns.*/
-  struct sigaction SIGINT_action = {{0}};
-  SIGINT_action.sa_handler = catchSIGINT;
-  sigfillset(&SIGINT_action.sa_mask);
-  SIGINT_action.sa_flags = SA_RESTART;
-  sigaction(SIGINT, &SIGINT_action, NULL);
-
-  /* SIGTSTP handler */
-  /* the SIGTSTP handler will block all other interrupts until it is finished,
-     and system calls will restart after the handler returns.*/
-  struct sigaction SIGTSTP_action = {{0}};
-  SIGTSTP_action.sa_handler = shellCatchSIGTSTP;
-  sigfillset(&SIGTSTP_action.sa_mask);
-  SIGTSTP_action.sa_flags = SA_RESTART;
-  sigaction(SIGTSTP, &SIGTSTP_action, NULL);
-
-  return;
+void traceOpen(char* fileName) {
+  traceFd = open(fileName, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if(traceFd == -1) {
+    printf("cannot open %s for tracing\n", fileName);
+    flushOutput();
+    return;
+  }
+  traceBuffer = malloc(TRACE_BUFFER_SIZE);
+  assert(traceBuffer != NULL);
+  clock_gettime(CLOCK_MONOTONIC, &traceStarted);
+  tracePrintf("[{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, "
+              "\"tid\": %d, \"args\": {\"name\": \"smallsh\"}}",
+              getpid(), getpid());
 }
 
 
 /*******************************************************************************
- *                          displayBGMessage
- * Description: detects a change in the background allowed flag and displays a 
- *   message if it has flipped
- * Input: 
- *   none
- *   All of the information this function needs is stored in two global flag
- *   variables
- * Output:
- *   none
- *   displays messages to stdout
+ *                           void traceClose()
+ * Description: ends the trace and writes out what is left of it
 *******************************************************************************/
-void displayBGMessage() {
-  /* if the flags are equal, then no change in background allowed state has
-     occured since a message was printed to the user. Do nothing. */
-  if(background_allowed == previous_background_allowed) {
+void traceClose() {
+  if(traceFd == -1) {
     return;
   }
-
-  /* else we know the flag has flipped. Print the appropriate message and update
-     the value of previous flag */
-  else if( background_allowed == 0 ) {
-    printf("\nEntering foreground-only mode (& is now ignored)\n");
-    fflush(stdout);
-  }
-  else {
-    printf("\nExiting foreground-only mode\n");
-    fflush(stdout);
-  }
-  previous_background_allowed = background_allowed;
+  tracePrintf("\n]\n");
+  traceFlush();
+  close(traceFd);
+  free(traceBuffer);
+  traceFd = -1;
+  traceBuffer = NULL;
 }
 
 
 /*******************************************************************************
- *                void prompt(char* promptInput, size_t bufferSize)
- * prints a prompt and gets user input for the next command.
+ *                   void traceClock(struct timespec* now)
+ * Description: reads the clock for an event, but only when tracing
 *******************************************************************************/
-void prompt(char** promptInput, size_t bufferSize) {
-  displayBGMessage();
-  /* display initial prompt */
-  write(STDOUT_FILENO, ":", 1);
-  /* while getline fails, keep printing prompts and attempt to collect input*/
-  while(getline(promptInput, &bufferSize, stdin) == -1) {
-    clearerr(stdin);
-    displayBGMessage();
-    write(STDOUT_FILENO, ":", 1);
+void traceClock(struct timespec* now) {
+  if(traceFd != -1) {
+    clock_gettime(CLOCK_MONOTONIC, now);
   }
-  /* remove the trailing \n from getline. this method is taken from the CS344
-     reading 3.3 at Oregon State University which can be found here:
-     https://oregonstate.instructure.com/courses/1738958/pages/3-dot-3-
-                                                advanced-user-input-with-getline
-  */
-  (*promptInput)[strcspn(*promptInput, "\n")] = '\0';
-
 }
 
 
 /*******************************************************************************
- *                   bool isBuiltIn(char*)
- * Determines if a command is a built-in command
- * Input: char* userInput
- * Output: 
- *   The index of the built-in commands as defined at the top of this file, or
- *   -1 if the input is not in the list of built-in commands.
+ *   void traceBegin(char* name, int tid, struct timespec* began,
+ *                   struct timespec* ended)
+ * Description: starts a complete event on the track of tid, running from
+ *   began to ended (or to now if ended is NULL). Its arguments, if any, are
+ *   added with traceArgument and the event is finished with traceEnd.
 *******************************************************************************/
-int isBuiltIn(char* userInput) {
-  
-  /* if userInput begins with '#', return COMMENT_CODE */
-  /* treat no input the same as comments */
-  if (userInput == NULL || userInput[0] == '#' || userInput[0] == '\0') {
-    return COMMENT_CODE;
+void traceBegin(char* name, int tid, struct timespec* began,
+                struct timespec* ended) {
+  struct timespec now;
+  if(ended == NULL) {
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ended = &now;
   }
-  
+  double start = (began->tv_sec - traceStarted.tv_sec) * 1e6 +
+                 (began->tv_nsec - traceStarted.tv_nsec) / 1e3;
+  double duration = (ended->tv_sec - began->tv_sec) * 1e6 +
+                    (ended->tv_nsec - began->tv_nsec) / 1e3;
+  tracePrintf(",\n{\"name\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, "
+              "\"dur\": %.3f, \"pid\": %d, \"tid\": %d, \"args\": {", name,
+              start, duration, getpid(), tid);
+}
 
-  /* determine which index of BUILT_IN_COMMANDS it is, if any */
-  int i;
-  for(i = 0; i < NUM_BUILT_INS; ++i) {
-    if(strcmp(userInput, builtInCommands[i]) == 0) {
-      return i;
-    }
-  }
 
-  return -1;
+/*******************************************************************************
+ *             void traceArgument(char* name, char* value, int first)
+ * Description: adds a string argument to the event being written
+*******************************************************************************/
+void traceArgument(char* name, char* value, int first) {
+  tracePrintf("%s\"%s\": ", first ? "" : ", ", name);
+  traceString(value);
 }
 
+
 /*******************************************************************************
- *                     void clearArgs(char** args)
- * frees all the memory for dynamically allocated args
+ *                            void traceEnd()
+ * Description: finishes the event being written
 *******************************************************************************/
-void clearArgs(char** args) {
-  int i;
-  for(i = 0; i < MAX_NUMBER_ARGS; ++i) {
-    if(args[i] != NULL) {
-      free(args[i]);
-      args[i] = NULL;
-    }
-    args[i] = NULL;
+void traceEnd() {
+  tracePrintf("}}");
+  if(traceUsed > TRACE_BUFFER_SIZE / 4 * 3) {
+    traceFlush();
   }
 }
 
 
 /*******************************************************************************
- *                         void getArgs(char*, char**)
- * Description: takes the user input and parses it into individual words which
- *   populate the char** args when the funcion ends
- * Input:
- *   - char* promptInput - a string of text containing all of the command-line 
- *       args
- *   - char** args - a pointer to an array of char*s which will be populated
- *       with the arguments
+ *          void traceEvent(char* name, struct timespec* began)
+ * Description: records that the shell spent from began until now on name
 *******************************************************************************/
-void getArgs(char* promptInput, char** args) {
-  int argsIndex = 0;
-  int promptIndex = 0;
-  int currWordIndex = 0;
-  char* currWord = malloc(sizeof(char) * ARBITRARY_MAX_WORD_LENGTH);
-  memset(currWord, '\0', ARBITRARY_MAX_WORD_LENGTH);
-
-  /* clear out args array before beginning */
-  clearArgs(args);
-    
-  while( promptInput[promptIndex] != '\0') {
-    /* if the character is not white-space, add it to the current word */
-    if (promptInput[promptIndex] != ' ' && promptInput[promptIndex] != '\t') {
-      currWord[currWordIndex] = promptInput[promptIndex];
-      currWordIndex++;
-    }
-    /* else the current character is white-space and it's time to save the 
-       current word and begin a new one */
-    else {
-      /* copy the word */
-      currWord[currWordIndex] = '\0';
-      args[argsIndex] = malloc(sizeof(char) * (currWordIndex + 1));
-      assert(args[argsIndex] != NULL);
-      strcpy(args[argsIndex], currWord);
-      argsIndex += 1;
-      /* reset currWord and currWordIndex */
-      memset(currWord, '\0', ARBITRARY_MAX_WORD_LENGTH);
-      currWordIndex = 0;
-    }
-    promptIndex += 1;
+void traceEvent(char* name, struct timespec* began) {
+  if(traceFd == -1) {
+    return;
   }
-
-  /* get the last word */
-  currWord[currWordIndex] = '\0';
-  args[argsIndex] = malloc(sizeof(char) * (currWordIndex + 1));
-  assert(args[argsIndex] != NULL);
-  strcpy(args[argsIndex], currWord);
-
-  free(currWord);
+  traceBegin(name, getpid(), began, NULL);
+  traceEnd();
 }
 
 
 /*******************************************************************************
- *                 char** initializeArgs()
- * Description: sets all pointers in args to NULL
- * Input: 
- *   none
- * Output: 
- *   a pointer to an array of char* set to NULL
+ *  void traceChild(int pid, int background, struct timespec* began,
+ *                  struct timespec* ended, int results)
+ * Description: records the lifetime of a child on its own track, along with
+ *   how it ended
 *******************************************************************************/
-char** initializeArgs() {
-  /* malloc space for MAX_NUMBER_ARGS in args */
-  char** args = malloc(sizeof(char*) * MAX_NUMBER_ARGS);
-  assert(args != NULL);
-
-  /* set each to NULL */
-  int i;
-  for(i = 0; i < MAX_NUMBER_ARGS; ++i) {
-    args[i] = NULL;
+void traceChild(int pid, int background, struct timespec* began,
+                struct timespec* ended, int results) {
+  char value[32];
+  if(traceFd == -1) {
+    return;
   }
-  
-  return args;
+  traceBegin("child", pid, began, ended);
+  sprintf(value, "%d", pid);
+  traceArgument("pid", value, TRUE);
+  traceArgument("background", background ? "true" : "false", FALSE);
+  if(WIFEXITED(results)) {
+    sprintf(value, "exit value %d", WEXITSTATUS(results));
+  }
+  else {
+    sprintf(value, "terminated by signal %d", WTERMSIG(results));
+  }
+  traceArgument("status", value, FALSE);
+  traceEnd();
 }
 
 
 /*******************************************************************************
- *                     void destroyArgs(char**)
- * Description: frees all memory allocated for the arguments array
- * Input: char** args - pointer to array of char*
- * Output: none
+ *                           struct Arena
+ * A chain of memory blocks that holds the words of a command line. The args
+ * array points into the arena, so an entire line is released by resetting
+ * the arena instead of freeing each word. The blocks are kept between
+ * lines, so once the arena has grown to fit the typical line no more memory is
+ * allocated.
 *******************************************************************************/
-void destroyArgs(char** args) {
-  clearArgs(args);
-  free(args);
-  args = NULL;
-}
+typedef struct ArenaBlock {
+  struct ArenaBlock* next;
+  size_t capacity;
+  size_t used;
+  char data[];
+} arenaBlock;
+
+typedef struct Arena {
+  arenaBlock* head;
+} arena;
+
 
 /*******************************************************************************
- *                   int isWord(char*) 
- * Returns true if the char* is not a special argument character and if it is
- * not null. Otherwise returns false
+ *                 char* arenaAlloc(arena* pool, size_t size)
+ * Description: returns size bytes of memory from the arena. A new block at
+ *   least twice as large as the current one is added when it does not fit.
+ * Input:
+ *   arena* pool - the arena to allocate from
+ *   size_t size - number of bytes needed
+ * Output:
+ *   a pointer to the memory, which is valid until the arena is reset
 *******************************************************************************/
-int isWord(char* word) {
-
-  /* if the word is empty (because either the pointer is set to null or 
-     the string is empty), return false */
-  if(word == NULL) {
-    return FALSE;
-  }
-  if(word[0] == '\0') {
-    return FALSE;
-  }
+char* arenaAlloc(arena* pool, size_t size) {
+  assert(pool != NULL);
 
-  /* if the word begins with a special character, return false */
-  if(word[0] == '<' || word[0] == '>' || word[0] == '&') {
-    if(word[1] == '\0') {
-      return FALSE;
+  if(pool->head == NULL || pool->head->capacity - pool->head->used < size) {
+    size_t capacity = INITIAL_ARENA_SIZE;
+    if(pool->head != NULL && pool->head->capacity * 2 > capacity) {
+      capacity = pool->head->capacity * 2;
+    }
+    if(capacity < size) {
+      capacity = size;
     }
+    arenaBlock* block = malloc(sizeof(arenaBlock) + capacity);
+    assert(block != NULL);
+    block->next = pool->head;
+    block->capacity = capacity;
+    block->used = 0;
+    pool->head = block;
   }
 
-  /* it must be a "word" for the purposes of our program. Return true */
-  return TRUE;
+  char* memory = pool->head->data + pool->head->used;
+  pool->head->used += size;
+  return memory;
 }
 
 
 /*******************************************************************************
- *         argsFilterDown(char** args,int actualIndex, int examineInex)
- * Filters down the arguments to fill in the gaps left by file redirection
- * commands and the like
- * Input:
- *   char** args - the pointer to the list of arguments (char*s)
- *   int* actualIndex - the index at which the argument at examine index should
- *     be placed
- *   int* examineIndex - the index of the argument that is being moved down
+ *                     void arenaReset(arena* pool)
+ * Description: releases everything allocated from the arena. Only the newest
+ *   (and largest) block is kept so that it can be reused for the next line.
 *******************************************************************************/
-void argsFilterDown(char** args, int* actualIndex, int* examineIndex) {
-  /* make sure the two arguments are not the same and that the one being
-     replaced is not null */
-  if (args[*actualIndex] != args[*examineIndex]) {
-    if (args[*actualIndex] != NULL) {
-      /* free dynamically allocated memory */
-      free(args[*actualIndex]);
-    }
-    /* perform the swap and */
-    args[*actualIndex] = args[*examineIndex];
-    args[*examineIndex] = NULL;
+void arenaReset(arena* pool) {
+  assert(pool != NULL);
+  if(pool->head == NULL) {
+    return;
   }
-  /* increment both indices */
-  *actualIndex += 1;
-  *examineIndex += 1;
+
+  arenaBlock* block = pool->head->next;
+  while(block != NULL) {
+    arenaBlock* next = block->next;
+    free(block);
+    block = next;
+  }
+  pool->head->next = NULL;
+  pool->head->used = 0;
 }
 
 
 /*******************************************************************************
- *                       replaceDoubleDollars(char*)
- * This function examines a string of characters four instances of '$$'. If '$$'
- * is found, it is replaced with the pid of the currently running process.
+ *                     void destroyArena(arena* pool)
+ * Description: frees every block owned by the arena
 *******************************************************************************/
-void replaceDoubleDollars(char** arg) {
-  assert(arg != NULL);
-  assert(*arg != NULL);
-  int index = 0;
-  /* iterate through the list until the next index is the null terminator. Since
-     we must examine one index ahead for the double $$ */
-  while (((*arg)[index] != '\0') && ((*arg)[index + 1] != '\0')) {
-    if((*arg)[index] == '$' && (*arg)[index + 1] == '$') {
-      
-      /* get length of original arg, allocate memory for a newArg, get the pid
-         as a string */
-      int lenNewArg = getStringLength(*arg) + 20;
-      char* newArg = malloc(sizeof(char) * lenNewArg);
-      memset(newArg, '\0', lenNewArg);
-
-      char pidString[20];
-      memset(pidString, '\0', 20);
-      sprintf(pidString, "%d", getpid());
-      int pidLen = getStringLength(pidString);
-      
-      /* copy the argument up until the $$ */
-      int subIndex = 0;
-      for(subIndex = 0; subIndex < index; subIndex++) {
-        newArg[subIndex] = (*arg)[subIndex];
-      }
-
-      /* add the pid */
-      strcpy(newArg + index, pidString);
-      /* copy the rest of the arg minus the two $ characters being replaced*/
-      strcpy(newArg + index + pidLen, (*arg) + index + 2);
-
-      /* rearrange the pointers to replace old arg with new arg and free dyn
-         memory */
-      free(*arg);
-      *arg = newArg;
-      return;
-    }
-    index += 1;
-  }
+void destroyArena(arena* pool) {
+  arenaReset(pool);
+  free(pool->head);
+  pool->head = NULL;
 }
 
+
 /*******************************************************************************
- *                    void parseArgs(char**)
- * Description: This function examines the list of arguments and does two things
- *   1) Looks for special operators - such as file redirection or background
- *      commands. In which case it sets flags and sets relevent global 
- *      variables
- *   2) Rearranges the arguments in args to move filter relevent commands down
- *      torwards args[0] as the special operators and their arguments are
- *      removed
- * Input:
- *   char** args - the array of pointers to characters which are the processed
- *     user input
- * Output:
- *   none.
- *   modifies char** args 
+ *                  void catchSIGINT(int sigNumber)
+ * Description: this function handles a SIGINT call. It prevents the termination
+ *   of the shell program while child processes are killed: the signal is
+ *   passed on to the process group of the foreground job, if there is one, and
+ *   interruptReceived is set so that a wait built-in (or a block) stops. It is
+ *   called from the event loop when SIGINT is read from the signalfd.
 *******************************************************************************/
-void parseArgs(char** args) {
-  int examineIndex = 0;
-  int actualIndex = 0;
-  
-  while(args[examineIndex] != NULL) {
+void catchSIGINT(int sigNumber) {
+  if(foregroundPgid > 0) {
+    kill(-foregroundPgid, sigNumber);
+  }
+  interruptReceived = TRUE;
+}
 
-    /* if args at examine index is '<', then set file redirection input */
-    if(strcmp(args[examineIndex], "<") == 0) {
-      if(isWord(args[examineIndex + 1])) {
-        /* then examineIndex + 1 is the name of a file for file input 
-           redirection. Set the flag and save the file name*/
-        inputRedirectionFlag = 1;
-        memset(inputRedirectionFileName, '\0', ARBITRARY_MAX_WORD_LENGTH);
-        strcpy(inputRedirectionFileName, args[examineIndex + 1]);
 
-        /* rearrange current working indecies */
+/*******************************************************************************
+ *                  void shellCatchSIGTSTP(int sigNumber)
+ * Description: this function handles a SIGTSTP signal received by the shell. 
+ *   It prevents the termination of the shell program and prints an informative
+ *   message. It also flips background_allowed to the opposite value. Either
+ *   allowing or dis-allowing background execution of programs. It is called
+ *   from the event loop when SIGTSTP is read from the signalfd.
+*******************************************************************************/
+void shellCatchSIGTSTP(int sigNumber) {
+  /* flip background_allowed to opposite value */
+  background_allowed ^= 1;
+
+  /* if the shell is not sitting at a prompt, leave the message for 
+     displayBGMessage to print before the next one */
+  if(waitingAtPrompt == FALSE) {
+    return;
+  }
+  /* if the shell is waiting for input, print a message about whether 
+     background processes are allowed immediately */
+  else if (background_allowed == 0) {
+    printf("\nEntering foreground-only mode (& is now ignored)\n");
+  }
+  else {
+    printf("\nExiting foreground-only mode\n");
+  }
+  flushOutput();
+  printPrompt();
+  /* set the duel flags equal to eachother so that the message will not be
+     repeated by the main shell program */
+  previous_background_allowed = background_allowed;
+  return;
+}
+ 
+
+
+/*******************************************************************************
+ *                         completion ring
+ * Children are reaped by the event loop as soon as SIGCHLD is read from the
+ * signalfd. Each background pid, its wait status, when it was reaped and the
+ * resources it used are stored in this ring buffer, and the prompt drains it
+ * to report the completions. When the ring is full reaping stops and
+ * completionOverflow is set. The children left over stay zombies until the
+ * prompt has made room and reaps them itself.
+*******************************************************************************/
+typedef struct Completion {
+  int pid;
+  int results;
+  struct timespec reaped;
+  struct rusage usage;
+} completion;
+
+completion completionRing[COMPLETION_RING_SIZE];
+unsigned completionHead = 0;
+unsigned completionTail = 0;
+int completionOverflow = FALSE;
+
+
+/*******************************************************************************
+ *          void addUsage(struct rusage* total, struct rusage* usage)
+ * Description: adds the user and system CPU time of usage to total. The
+ *   largest maximum resident set size of the two is kept.
+*******************************************************************************/
+void addUsage(struct rusage* total, struct rusage* usage) {
+  timeradd(&total->ru_utime, &usage->ru_utime, &total->ru_utime);
+  timeradd(&total->ru_stime, &usage->ru_stime, &total->ru_stime);
+  if(usage->ru_maxrss > total->ru_maxrss) {
+    total->ru_maxrss = usage->ru_maxrss;
+  }
+}
+
+
+/*******************************************************************************
+ *   void printTimes(struct timespec* started, struct timespec* ended,
+ *                   struct rusage* usage)
+ * Description: prints the wall time between started and ended, the CPU time
+ *   and the maximum resident set size of usage, in the form
+ *   "real 1.002s user 0.950s sys 0.012s maxrss 2048kB". No newline is printed.
+*******************************************************************************/
+void printTimes(struct timespec* started, struct timespec* ended,
+                struct rusage* usage) {
+  double real = (ended->tv_sec - started->tv_sec) +
+                (ended->tv_nsec - started->tv_nsec) / 1e9;
+  printf("real %.3fs user %.3fs sys %.3fs maxrss %ldkB", real,
+         usage->ru_utime.tv_sec + usage->ru_utime.tv_usec / 1e6,
+         usage->ru_stime.tv_sec + usage->ru_stime.tv_usec / 1e6,
+         usage->ru_maxrss);
+}
+
+
+/*******************************************************************************
+ *                       void foregroundAdd(int pid)
+ * Description: records a child the shell has to wait for before it can prompt
+ *   again. The children of a pipeline are added in order, so the last one added
+ *   is the one whose status is saved.
+*******************************************************************************/
+void foregroundAdd(int pid) {
+  if(numForegroundPids == foregroundCapacity) {
+    foregroundCapacity = foregroundCapacity == 0 ? 8 : foregroundCapacity * 2;
+    foregroundPids = realloc(foregroundPids, sizeof(int) * foregroundCapacity);
+    assert(foregroundPids != NULL);
+  }
+  foregroundPids[numForegroundPids] = pid;
+  numForegroundPids += 1;
+  foregroundRemaining += 1;
+}
+
+
+/*******************************************************************************
+ *     int foregroundReaped(int pid, int results, struct rusage* usage)
+ * Description: checks whether a reaped child is one the shell is waiting for in
+ *   the foreground, and if so crosses it off. The status of the last child of
+ *   the foreground command is saved in foregroundResults. Its resource use is
+ *   added to foregroundUsage and foregroundEnded is set to the time it was
+ *   reaped.
+ *   A foreground child that was stopped is not crossed off. Its signal is
+ *   saved in foregroundStopped, which ends the wait for the job. The one
+ *   exception is a child stopped for using the terminal before it was handed
+ *   over: once the job owns the terminal the child is simply continued.
+ * Output: TRUE if pid was a foreground child
+*******************************************************************************/
+int foregroundReaped(int pid, int results, struct rusage* usage) {
+  int i;
+  for(i = 0; i < numForegroundPids; ++i) {
+    if(foregroundPids[i] == pid && WIFCONTINUED(results)) {
+      return TRUE;
+    }
+    else if(foregroundPids[i] == pid && WIFSTOPPED(results)) {
+      if(foregroundOwnsTerminal && (WSTOPSIG(results) == SIGTTIN ||
+                                    WSTOPSIG(results) == SIGTTOU)) {
+        kill(pid, SIGCONT);
+      }
+      else {
+        foregroundStopped = WSTOPSIG(results);
+      }
+      return TRUE;
+    }
+    else if(foregroundPids[i] == pid) {
+      foregroundPids[i] = 0;
+      foregroundRemaining -= 1;
+      addUsage(&foregroundUsage, usage);
+      clock_gettime(CLOCK_MONOTONIC, &foregroundEnded);
+      traceChild(pid, FALSE, &foregroundStarted, &foregroundEnded, results);
+      if(i == numForegroundPids - 1) {
+        foregroundResults = results;
+      }
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+
+/*******************************************************************************
+ *                        void reapChildren()
+ * Description: reaps every child that has exited, with one wait4(-1) per
+ *   child, which also gives the resources the child used. Children that were
+ *   stopped or continued are reported the same way. Foreground children are
+ *   crossed off with foregroundReaped, every other child is recorded in the
+ *   completion ring.
+*******************************************************************************/
+void reapChildren() {
+  struct rusage usage;
+  int results;
+  int pid;
+  int i;
+
+  while(TRUE) {
+    if(completionHead - completionTail == COMPLETION_RING_SIZE) {
+      completionOverflow = TRUE;
+      /* the foreground children must still be collected so the wait for them
+         can end */
+      for(i = 0; i < numForegroundPids; ++i) {
+        pid = foregroundPids[i];
+        if(pid != 0 &&
+           wait4(pid, &results, WNOHANG | WUNTRACED, &usage) > 0) {
+          foregroundReaped(pid, results, &usage);
+        }
+      }
+      return;
+    }
+    pid = wait4(-1, &results, WNOHANG | WUNTRACED | WCONTINUED, &usage);
+    if(pid <= 0) {
+      return;
+    }
+    if(foregroundReaped(pid, results, &usage)) {
+      continue;
+    }
+    completion* entry = &completionRing[completionHead % COMPLETION_RING_SIZE];
+    entry->pid = pid;
+    entry->results = results;
+    entry->usage = usage;
+    clock_gettime(CLOCK_MONOTONIC, &entry->reaped);
+    completionHead += 1;
+  }
+}
+
+
+/*******************************************************************************
+ *                  void catchSIGCHLD(int sigNumber)
+ * Description: this function handles a SIGCHLD signal by reaping the children
+ *   that have exited. It is called from the event loop.
+*******************************************************************************/
+void catchSIGCHLD(int sigNumber) {
+  STATS_BEGIN(began);
+  struct timespec traceBegan;
+  traceClock(&traceBegan);
+  reapChildren();
+  STATS_END(STAT_REAP, began);
+  traceEvent("reap", &traceBegan);
+}
+
+
+/*******************************************************************************
+ *                         struct LineReader
+ * Reads the shell's input in blocks with read() and hands it out one line at a
+ * time, so that input can be waited for with epoll alongside the signalfd. A
+ * line is returned in place, with its '\n' replaced by a '\0', and stays valid
+ * until the reader is next asked for more input. A script file is mapped
+ * (privately, so the '\0's stay in the shell) and a -c command is used where
+ * it is, in which case the whole input is in the buffer from the start and
+ * eof is already set.
+*******************************************************************************/
+typedef struct LineReader {
+  int fd;
+  char* buffer;
+  size_t capacity;
+  size_t start;
+  size_t end;
+  size_t blockSize;
+  int eof;
+  int pollable;
+  int armed;
+  int ready;
+  int mapped;
+} lineReader;
+
+lineReader input = {STDIN_FILENO, NULL, 0, 0, 0, INPUT_BLOCK_SIZE, FALSE, FALSE,
+                    FALSE, FALSE, FALSE};
+
+
+/*******************************************************************************
+ *                  char* readerNextLine(lineReader* reader)
+ * Description: returns the next complete line in the buffer. Once the input
+ *   has ended, a last line without a '\n' is returned as well.
+ * Output: the line, or NULL if more input is needed (or there is none left)
+*******************************************************************************/
+char* readerNextLine(lineReader* reader) {
+  char* line = reader->buffer + reader->start;
+  char* newline = memchr(line, '\n', reader->end - reader->start);
+
+  if(newline != NULL) {
+    *newline = '\0';
+    reader->start = newline - reader->buffer + 1;
+    return line;
+  }
+  /* readerFill always leaves room for this '\0' */
+  if(reader->eof && reader->start < reader->end) {
+    reader->buffer[reader->end] = '\0';
+    reader->start = reader->end;
+    return line;
+  }
+  return NULL;
+}
+
+
+/*******************************************************************************
+ *                   void readerFill(lineReader* reader)
+ * Description: moves any partial line to the front of the buffer, growing it
+ *   if the partial line fills it, and reads the next block of input
+*******************************************************************************/
+void readerFill(lineReader* reader) {
+  if(reader->start > 0) {
+    memmove(reader->buffer, reader->buffer + reader->start,
+            reader->end - reader->start);
+    reader->end -= reader->start;
+    reader->start = 0;
+  }
+  if(reader->capacity - reader->end < reader->blockSize + 1) {
+    reader->capacity = reader->capacity == 0 ? reader->blockSize + 1 :
+                       reader->capacity * 2;
+    reader->buffer = realloc(reader->buffer, reader->capacity);
+    assert(reader->buffer != NULL);
+  }
+
+  ssize_t bytesRead = read(reader->fd, reader->buffer + reader->end,
+                           reader->capacity - reader->end - 1);
+  if(bytesRead > 0) {
+    reader->end += bytesRead;
+  }
+  else if(bytesRead == 0 || (errno != EINTR && errno != EAGAIN)) {
+    reader->eof = TRUE;
+  }
+}
+
+
+/*******************************************************************************
+ *                           struct CaptureStream
+ * The capture built-in collects the standard output of background jobs, which
+ * would otherwise go to /dev/null:
+ *   - CAPTURE_FILE - every job writes into one log (or the shell's stdout),
+ *     a line at a time, so lines from different jobs are never mixed
+ *   - CAPTURE_JOBS - each job writes into a log of its own in a directory,
+ *     named after the job's process group
+ * A captured job's last stage writes into a pipe that the shell keeps the
+ * read end of (a stream). The read ends are registered with epoll, edge
+ * triggered, and the shell moves what arrives from the pipe into the log with
+ * splice(), so the kernel moves the output without it passing through the
+ * shell. In a combined log only complete lines are moved: the pipe is first
+ * duplicated with tee() into the scratch pipe, which is read (and thrown away)
+ * to find the last '\n', and what is after it stays in the job's pipe until
+ * the rest of the line (or the end of the output) arrives. A line longer than
+ * CAPTURE_CHUNK, or one that fills the pipe, is moved as it is. Each stream
+ * has its own descriptor for the log. The combined log is opened without
+ * O_APPEND, which splice() refuses, and its copies share one offset. A log
+ * that splice() cannot write to (such as a stdout opened for appending) is
+ * written with read() and write().
+*******************************************************************************/
+typedef struct CaptureStream {
+  int pipe;
+  int file;
+  int whole;
+  int capacity;
+  int number;
+  struct CaptureStream* next;
+} captureStream;
+
+typedef struct Capture {
+  int mode;
+  char* target;
+  int file;
+  int scratch[2];
+  char* buffer;
+  captureStream* streams;
+} capture;
+
+capture jobCapture = {CAPTURE_OFF, NULL, -1, {-1, -1}, NULL, NULL};
+
+
+/*******************************************************************************
+ *                  captureStream* captureFind(int fd)
+ * Description: finds the stream whose pipe is fd
+ * Output: the stream, or NULL if fd is not a capture pipe
+*******************************************************************************/
+captureStream* captureFind(int fd) {
+  captureStream* stream;
+  for(stream = jobCapture.streams; stream != NULL; stream = stream->next) {
+    if(stream->pipe == fd) {
+      return stream;
+    }
+  }
+  return NULL;
+}
+
+
+/*******************************************************************************
+ *                  void captureClose(captureStream* stream)
+ * Description: closes a stream's pipe and log and forgets the stream
+*******************************************************************************/
+void captureClose(captureStream* stream) {
+  captureStream** link = &jobCapture.streams;
+  while(*link != stream) {
+    link = &(*link)->next;
+  }
+  *link = stream->next;
+  close(stream->pipe);
+  if(stream->file != -1) {
+    close(stream->file);
+  }
+  free(stream);
+}
+
+
+/*******************************************************************************
+ *            int captureMove(captureStream* stream, size_t length)
+ * Description: moves length bytes, which are in the stream's pipe, into its
+ *   log
+ * Output: FALSE if the log could not be written
+*******************************************************************************/
+int captureMove(captureStream* stream, size_t length) {
+  while(length > 0) {
+    ssize_t moved = splice(stream->pipe, NULL, stream->file, NULL, length,
+                           SPLICE_F_MOVE);
+    if(moved == -1 && errno == EINVAL) {
+      moved = read(stream->pipe, jobCapture.buffer,
+                   length < CAPTURE_CHUNK ? length : CAPTURE_CHUNK);
+      if(moved > 0 && write(stream->file, jobCapture.buffer, moved) != moved) {
+        return FALSE;
+      }
+    }
+    if(moved == -1 && errno == EINTR) {
+      continue;
+    }
+    if(moved <= 0) {
+      return FALSE;
+    }
+    length -= moved;
+  }
+  return TRUE;
+}
+
+
+/*******************************************************************************
+ *             void captureDrain(captureStream* stream, int ended)
+ * Description: moves what is in a stream's pipe into its log, only up to the
+ *   last complete line for a combined log unless ended is set (the job has
+ *   closed its end of the pipe), in which case the stream is closed as well
+*******************************************************************************/
+void captureDrain(captureStream* stream, int ended) {
+  int available;
+  /* the shell's own messages come first if they are going to the same place */
+  fflush(stdout);
+
+  while(ioctl(stream->pipe, FIONREAD, &available) == 0 && available > 0) {
+    size_t length = available;
+    if(stream->whole) {
+      ssize_t looked = tee(stream->pipe, jobCapture.scratch[1],
+                           length < CAPTURE_CHUNK ? length : CAPTURE_CHUNK,
+                           SPLICE_F_NONBLOCK);
+      if(looked <= 0 ||
+         read(jobCapture.scratch[0], jobCapture.buffer, looked) != looked) {
+        break;
+      }
+      char* newline = memrchr(jobCapture.buffer, '\n', looked);
+      if(newline != NULL) {
+        length = newline - jobCapture.buffer + 1;
+      }
+      else if(!ended && looked == available && available < stream->capacity) {
+        break;
+      }
+      else {
+        length = looked;
+      }
+    }
+    if(!captureMove(stream, length)) {
+      printf("capture: job %d: %s\n", stream->number, strerror(errno));
+      flushOutput();
+      ended = TRUE;
+      break;
+    }
+  }
+
+  if(ended) {
+    captureClose(stream);
+  }
+}
+
+
+/*******************************************************************************
+ *                       int captureStart(int number)
+ * Description: makes a stream for background job number if capturing is on.
+ *   In CAPTURE_JOBS mode its log is opened by captureStarted.
+ * Output: the write end of the stream's pipe for the job's last stage, or -1
+ *   if the job is not captured
+*******************************************************************************/
+int captureStart(int number) {
+  int pipeFiles[2];
+  int file = -1;
+  if(jobCapture.mode == CAPTURE_OFF) {
+    return -1;
+  }
+  if(jobCapture.mode == CAPTURE_FILE) {
+    file = fcntl(jobCapture.file, F_DUPFD_CLOEXEC, 0);
+    if(file == -1) {
+      return -1;
+    }
+  }
+  if(pipe2(pipeFiles, O_CLOEXEC) == -1) {
+    if(file != -1) {
+      close(file);
+    }
+    return -1;
+  }
+
+  captureStream* stream = malloc(sizeof(captureStream));
+  assert(stream != NULL);
+  stream->pipe = pipeFiles[0];
+  stream->file = file;
+  stream->whole = jobCapture.mode == CAPTURE_FILE;
+  stream->capacity = fcntl(stream->pipe, F_GETPIPE_SZ);
+  stream->number = number;
+  stream->next = jobCapture.streams;
+  jobCapture.streams = stream;
+
+  struct epoll_event event = {0};
+  event.events = EPOLLIN | EPOLLET;
+  event.data.fd = stream->pipe;
+  epoll_ctl(epollFd, EPOLL_CTL_ADD, stream->pipe, &event);
+  return pipeFiles[1];
+}
+
+
+/*******************************************************************************
+ *                       void captureStarted(int pgid)
+ * Description: called once the job of the stream made last by captureStart
+ *   has been launched, with its process group (0 if it did not start). A
+ *   job of its own gets its log, named after the process group, now. The
+ *   stream is dropped if there is nothing to capture or nowhere to put it.
+*******************************************************************************/
+void captureStarted(int pgid) {
+  captureStream* stream = jobCapture.streams;
+  if(pgid == 0) {
+    captureClose(stream);
+    return;
+  }
+  if(stream->file != -1) {
+    return;
+  }
+
+  char* path = malloc(strlen(jobCapture.target) + 32);
+  assert(path != NULL);
+  sprintf(path, "%s/%d.log", jobCapture.target, pgid);
+  stream->file = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+  if(stream->file == -1) {
+    printf("capture: cannot open %s\n", path);
+    flushOutput();
+    captureClose(stream);
+  }
+  free(path);
+}
+
+
+/*******************************************************************************
+ *                          void captureClear()
+ * Description: moves what the captured jobs have written so far into their
+ *   logs and closes every stream, then turns capturing off
+*******************************************************************************/
+void captureClear() {
+  while(jobCapture.streams != NULL) {
+    captureDrain(jobCapture.streams, TRUE);
+  }
+  if(jobCapture.file != -1) {
+    close(jobCapture.file);
+  }
+  if(jobCapture.scratch[0] != -1) {
+    close(jobCapture.scratch[0]);
+    close(jobCapture.scratch[1]);
+  }
+  free(jobCapture.target);
+  free(jobCapture.buffer);
+  jobCapture.mode = CAPTURE_OFF;
+  jobCapture.target = NULL;
+  jobCapture.file = -1;
+  jobCapture.scratch[0] = -1;
+  jobCapture.scratch[1] = -1;
+  jobCapture.buffer = NULL;
+}
+
+
+/*******************************************************************************
+ *                    void handleEvents(int timeout)
+ * Description: waits up to timeout milliseconds (-1 for no limit, 0 to only
+ *   check) for the events the shell multiplexes with epoll and handles them:
+ *     - stdin readable: noted in input.ready for the prompt to read. stdin is
+ *       registered one-shot so it does not fire again until the prompt wants
+ *       more input.
+ *     - signalfd readable: each pending SIGINT, SIGTSTP and SIGCHLD is read
+ *       and passed to its handler.
+ *     - a capture pipe readable or closed: what the job wrote is moved into
+ *       its log (see struct CaptureStream).
+*******************************************************************************/
+void handleEvents(int timeout) {
+  struct epoll_event events[MAX_EVENTS];
+  int numEvents = epoll_wait(epollFd, events, MAX_EVENTS, timeout);
+
+  int i;
+  for(i = 0; i < numEvents; ++i) {
+    if(events[i].data.fd == STDIN_FILENO) {
+      input.armed = FALSE;
+      input.ready = TRUE;
+      continue;
+    }
+    if(events[i].data.fd != signalFd) {
+      captureStream* stream = captureFind(events[i].data.fd);
+      if(stream != NULL) {
+        captureDrain(stream, (events[i].events & (EPOLLHUP | EPOLLERR)) != 0);
+      }
+      continue;
+    }
+
+    struct signalfd_siginfo info;
+    int childExited = FALSE;
+    while(read(signalFd, &info, sizeof(info)) == sizeof(info)) {
+      switch(info.ssi_signo) {
+        case SIGINT:
+          catchSIGINT(SIGINT);
+          break;
+        case SIGTSTP:
+          shellCatchSIGTSTP(SIGTSTP);
+          break;
+        case SIGCHLD:
+          childExited = TRUE;
+          break;
+      }
+    }
+    /* a single pass reaps every child no matter how many SIGCHLDs merged */
+    if(childExited) {
+      catchSIGCHLD(SIGCHLD);
+    }
+  }
+}
+
+
+/*******************************************************************************
+ *                        struct processArray
+ * This struct will hold data about the currently running background processes.
+ * It is a slot map indexed by a pid hash table so that adding, finding and
+ * removing a process all take constant time no matter how many are running:
+ *   - jobs is the slot storage. Unused slots are chained into a free list
+ *     through their next field.
+ *   - buckets holds, for each pid hash, the first slot in that bucket. Slots in
+ *     the same bucket are chained through hashNext.
+ *   - live slots are also kept in a doubly linked list (first/last, prev/next)
+ *     in the order the processes were started, so they can be walked without
+ *     looking at the unused slots.
+ * An index of -1 marks the end of every chain. Each job also remembers when it
+ * was started and whether its times are reported when it is done.
+ * The processes of one command line make up a job, which is numbered for the
+ * jobs, fg, bg, wait and kill built-ins. Every process of the job has the
+ * job's number, process group and command line (name), and they sit next to
+ * each other in the live list. stopped is the signal that stopped the
+ * process while it is stopped (0 while it runs), and numStopped counts the
+ * processes that are. Job numbers start again at 1
+ * whenever there are no jobs left. The status of the process waitPid is saved
+ * in waitResults when it is done, for the wait built-in. The processes of a
+ * limited job with a cgroup of its own also have the cgroup's path, and
+ * place is the placement slot a background process was started on (or -1).
+*******************************************************************************/
+typedef struct Job {
+  int pid;
+  int hashNext;
+  int prev;
+  int next;
+  int timed;
+  struct timespec started;
+  int number;
+  int pgid;
+  int stopped;
+  char* name;
+  char* cgroup;
+  int place;
+} job;
+
+typedef struct processArray {
+  int capacity;
+  int size;
+  job* jobs;
+  int* buckets;
+  int freeHead;
+  int first;
+  int last;
+  int lastPid;
+  int lastJob;
+  int numStopped;
+  int waitPid;
+  int waitResults;
+} processes;
+
+
+/*******************************************************************************
+ *                int processBucket(processes* procs, int pid)
+ * Description: returns the bucket a pid hashes to. capacity is always a power
+ *   of two.
+*******************************************************************************/
+int processBucket(processes* procs, int pid) {
+  return (int)(((unsigned)pid * 2654435761u) & (unsigned)(procs->capacity - 1));
+}
+
+
+/*******************************************************************************
+ *                  void growProcessArray(processes* procs)
+ * Description: doubles the number of slots, links the new ones into the free
+ *   list and rebuilds the buckets for the new capacity
+*******************************************************************************/
+void growProcessArray(processes* procs) {
+  int oldCapacity = procs->capacity;
+  int newCapacity = oldCapacity == 0 ? 16 : oldCapacity * 2;
+
+  procs->jobs = realloc(procs->jobs, sizeof(job) * newCapacity);
+  assert(procs->jobs != NULL);
+  free(procs->buckets);
+  procs->buckets = malloc(sizeof(int) * newCapacity);
+  assert(procs->buckets != NULL);
+  procs->capacity = newCapacity;
+
+  /* new slots go on the front of the free list */
+  int i;
+  for(i = newCapacity - 1; i >= oldCapacity; --i) {
+    procs->jobs[i].pid = 0;
+    procs->jobs[i].next = procs->freeHead;
+    procs->freeHead = i;
+  }
+
+  /* re-hash the live slots */
+  for(i = 0; i < newCapacity; ++i) {
+    procs->buckets[i] = -1;
+  }
+  for(i = procs->first; i != -1; i = procs->jobs[i].next) {
+    int bucket = processBucket(procs, procs->jobs[i].pid);
+    procs->jobs[i].hashNext = procs->buckets[bucket];
+    procs->buckets[bucket] = i;
+  }
+}
+
+
+/*******************************************************************************
+ *                       processes* createProcessArray()
+ * Returns a pointer to a fully initialized processArray 
+ * Input:
+ *   none
+ * Output:
+ *   A pointer to a new processes struct that is initalized with valid data
+*******************************************************************************/
+processes* createProcessArray() {
+  processes* newProcesses = malloc(sizeof(processes));
+  assert(newProcesses != NULL);
+  newProcesses->capacity = 0;
+  newProcesses->size = 0;
+  newProcesses->jobs = NULL;
+  newProcesses->buckets = NULL;
+  newProcesses->freeHead = -1;
+  newProcesses->first = -1;
+  newProcesses->last = -1;
+  newProcesses->lastPid = 0;
+  newProcesses->lastJob = 0;
+  newProcesses->numStopped = 0;
+  newProcesses->waitPid = 0;
+  newProcesses->waitResults = 0;
+
+  /* the slots are only made when the first job is added */
+  return newProcesses;
+}
+
+
+/*******************************************************************************
+ *                       process printProcesses(processes*)
+ * prints all of the pids in the processes array
+ * Input:
+ *   pointer to processes
+ * Output:
+ *   none
+ *   displays current bg process ids to stdout
+*******************************************************************************/
+void printProcesses(processes* procs) {
+  int i;
+  for(i = procs->first; i != -1; i = procs->jobs[i].next) {
+    printf("procs[%d]: %d\n", i, procs->jobs[i].pid);
+  }
+  flushOutput();
+}
+
+
+/*******************************************************************************
+ *                      void destroyProcessArray(proc)
+ * deallocates memory for proc and sets to NULL
+ * Input: 
+ *   a pointer to a processes struct
+ * Output: 
+ *   none
+*******************************************************************************/
+void destroyProcessArray(processes* procs) {
+  assert(procs != NULL);
+
+  int i;
+  for(i = procs->first; i != -1; i = procs->jobs[i].next) {
+    free(procs->jobs[i].name);
+    free(procs->jobs[i].cgroup);
+  }
+  free(procs->jobs);
+  free(procs->buckets);
+  free(procs);
+  procs = NULL;
+}
+
+
+/*******************************************************************************
+ *                 int processesFind(processes*, int)
+ * finds the slot holding a pid
+ * Input:
+ *   processes* proc - a pointer to a processes struct
+ *   int val - the pid to look for
+ * Output:
+ *   the index of the pid's slot in proc->jobs, or -1 if it is not tracked
+*******************************************************************************/
+int processesFind(processes* proc, int val) {
+  assert(proc != NULL);
+  if(proc->capacity == 0) {
+    return -1;
+  }
+
+  int i = proc->buckets[processBucket(proc, val)];
+  while(i != -1 && proc->jobs[i].pid != val) {
+    i = proc->jobs[i].hashNext;
+  }
+  return i;
+}
+
+
+/*******************************************************************************
+ *                   void processesAdd(processes*, int)
+ * adds a pid to the processes array
+ * Input:
+ *   processes * proc - a pointer to a precesses struct dynamic array
+ *   int val - the value (pid) to be added to the array
+*******************************************************************************/
+void processesAdd(processes* proc, int val) {
+  assert(proc != NULL);
+
+  /* double the capacity if there are no free slots left */
+  if(proc->freeHead == -1) {
+    growProcessArray(proc);
+  }
+
+  /* take the first free slot. it is not part of any job yet */
+  int index = proc->freeHead;
+  job* newJob = &proc->jobs[index];
+  proc->freeHead = newJob->next;
+
+  newJob->pid = val;
+  newJob->timed = FALSE;
+  newJob->number = 0;
+  newJob->pgid = val;
+  newJob->stopped = FALSE;
+  newJob->name = NULL;
+  newJob->cgroup = NULL;
+  newJob->place = -1;
+  int bucket = processBucket(proc, val);
+  newJob->hashNext = proc->buckets[bucket];
+  proc->buckets[bucket] = index;
+
+  /* append it to the list of live processes */
+  newJob->prev = proc->last;
+  newJob->next = -1;
+  if(proc->last != -1) {
+    proc->jobs[proc->last].next = index;
+  }
+  else {
+    proc->first = index;
+  }
+  proc->last = index;
+  proc->size += 1;
+}
+
+
+/*******************************************************************************
+ *                   int processesNewJob(processes* procs)
+ * Description: hands out the number of the next job
+*******************************************************************************/
+int processesNewJob(processes* procs) {
+  procs->lastJob = procs->size == 0 ? 1 : procs->lastJob + 1;
+  return procs->lastJob;
+}
+
+
+/*******************************************************************************
+ *                int processesRunningJobs(processes* procs)
+ * Description: counts the jobs that have a process which is not stopped. The
+ *   processes of a job sit next to each other in the live list, so each job
+ *   is counted at the first of its running processes.
+*******************************************************************************/
+int processesRunningJobs(processes* procs) {
+  int running = 0;
+  int counted = 0;
+  int i;
+  for(i = procs->first; i != -1; i = procs->jobs[i].next) {
+    if(!procs->jobs[i].stopped && procs->jobs[i].number != counted) {
+      counted = procs->jobs[i].number;
+      running += 1;
+    }
+  }
+  return running;
+}
+
+
+/*******************************************************************************
+ *      void processesSetStopped(processes* procs, int index, int signal)
+ * Description: marks the process in slot index as stopped by signal, or as
+ *   running when signal is 0
+*******************************************************************************/
+void processesSetStopped(processes* procs, int index, int signal) {
+  if((procs->jobs[index].stopped != 0) != (signal != 0)) {
+    procs->numStopped += signal != 0 ? 1 : -1;
+  }
+  procs->jobs[index].stopped = signal;
+}
+
+
+/*******************************************************************************
+ *               void processesRemove(processes*, int)
+ * finds the pid in the array and removes it from the dynamic array
+ * Input: 
+ *   processes* proc: a poniter to a processes struct dynamic array
+ *   int val - the pid of the process to be removed
+*******************************************************************************/
+void processesRemove(processes* proc, int val) {
+  assert(proc != NULL);
+  if(proc->capacity == 0) {
+    return;
+  }
+
+  /* unlink the slot from its hash bucket */
+  int* link = &proc->buckets[processBucket(proc, val)];
+  while(*link != -1 && proc->jobs[*link].pid != val) {
+    link = &proc->jobs[*link].hashNext;
+  }
+  if(*link == -1) {
+    return;
+  }
+  int index = *link;
+  job* oldJob = &proc->jobs[index];
+  *link = oldJob->hashNext;
+
+  /* unlink it from the list of live processes */
+  if(oldJob->prev != -1) {
+    proc->jobs[oldJob->prev].next = oldJob->next;
+  }
+  else {
+    proc->first = oldJob->next;
+  }
+  if(oldJob->next != -1) {
+    proc->jobs[oldJob->next].prev = oldJob->prev;
+  }
+  else {
+    proc->last = oldJob->prev;
+  }
+
+  /* and give the slot back to the free list */
+  if(oldJob->stopped) {
+    proc->numStopped -= 1;
+  }
+  free(oldJob->name);
+  free(oldJob->cgroup);
+  oldJob->name = NULL;
+  oldJob->cgroup = NULL;
+  oldJob->pid = 0;
+  oldJob->next = proc->freeHead;
+  proc->freeHead = index;
+  proc->size -= 1;
+}
+
+
+
+/*******************************************************************************
+ *              void openInput(int argc, char** argv)
+ * Description: decides where the shell's commands come from:
+ *     smallsh [-i] [-q]             - read from stdin
+ *     smallsh [-i] [-q] -c command  - run the lines of command
+ *     smallsh [-i] [-q] script      - run the lines of the file script
+ *   The shell is interactive, showing prompts and flushing every message, only
+ *   when stdin is a terminal and no script is given, or when -i is given.
+ *   Otherwise stdout is fully buffered and stdin is read in large blocks. -q
+ *   leaves out the banner with the shell's pid.
+*******************************************************************************/
+void openInput(int argc, char** argv) {
+  int forceInteractive = FALSE;
+  char* command = NULL;
+  char* script = NULL;
+
+  int i;
+  for(i = 1; i < argc; ++i) {
+    if(strcmp(argv[i], "-i") == 0) {
+      forceInteractive = TRUE;
+    }
+    else if(strcmp(argv[i], "-q") == 0) {
+      quiet = TRUE;
+    }
+    else if(strcmp(argv[i], "-c") == 0 && i + 1 < argc && command == NULL) {
+      command = argv[++i];
+    }
+    else if(argv[i][0] != '-' && script == NULL && command == NULL) {
+      script = argv[i];
+    }
+    else {
+      fprintf(stderr, "usage: smallsh [-i] [-q] [-c command | script]\n");
+      exit(2);
+    }
+  }
+
+  if(command != NULL) {
+    input.fd = -1;
+    input.buffer = command;
+    input.end = strlen(command);
+    input.capacity = input.end + 1;
+    input.eof = TRUE;
+  }
+  else if(script != NULL) {
+    input.fd = open(script, O_RDONLY | O_CLOEXEC);
+    if(input.fd == -1) {
+      fprintf(stderr, "smallsh: cannot open %s: %s\n", script, strerror(errno));
+      exit(1);
+    }
+    /* map the script when the '\0' after a final line without a '\n' still
+       falls inside the last mapped page. Otherwise it is read normally */
+    struct stat fileInfo;
+    long pageSize = sysconf(_SC_PAGESIZE);
+    if(fstat(input.fd, &fileInfo) == 0 && S_ISREG(fileInfo.st_mode) &&
+       fileInfo.st_size > 0 && fileInfo.st_size % pageSize != 0) {
+      void* map = mmap(NULL, fileInfo.st_size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE, input.fd, 0);
+      if(map != MAP_FAILED) {
+        input.buffer = map;
+        input.end = fileInfo.st_size;
+        input.capacity = input.end + 1;
+        input.eof = TRUE;
+        input.mapped = TRUE;
+      }
+    }
+    input.blockSize = BATCH_BLOCK_SIZE;
+  }
+  else {
+    /* stdin is armed by the prompt when it needs more input. epoll refuses
+       regular files, which are always readable anyway */
+    struct epoll_event event = {0};
+    event.events = EPOLLIN | EPOLLONESHOT;
+    event.data.fd = STDIN_FILENO;
+    if(epoll_ctl(epollFd, EPOLL_CTL_ADD, STDIN_FILENO, &event) == 0) {
+      input.pollable = TRUE;
+      input.armed = TRUE;
+    }
+    if(!isatty(STDIN_FILENO)) {
+      input.blockSize = BATCH_BLOCK_SIZE;
+    }
+  }
+
+  interactive = forceInteractive ||
+                (command == NULL && script == NULL && isatty(STDIN_FILENO));
+  if(!interactive) {
+    setvbuf(stdout, NULL, _IOFBF, OUTPUT_BUFFER_SIZE);
+  }
+}
+
+
+/*******************************************************************************
+ *                      void closeInput()
+ * Description: releases the input buffer or the mapped script. A -c command
+ *   (with no fd) belongs to argv and is left alone.
+*******************************************************************************/
+void closeInput() {
+  if(input.mapped) {
+    munmap(input.buffer, input.end);
+  }
+  else if(input.fd == STDIN_FILENO) {
+    free(input.buffer);
+  }
+  if(input.fd > STDIN_FILENO) {
+    close(input.fd);
+  }
+}
+
+
+/*******************************************************************************
+ *                   void setInterrupts()
+ * Description: sets up all the interrupts for int main()
+ *   SIGINT, SIGTSTP and SIGCHLD are blocked and read from a signalfd by the
+ *   event loop instead of interrupting the shell with handlers. SIGTSTP is also
+ *   ignored. A signal that is blocked is still queued even while it is
+ *   ignored, so the shell sees it through the signalfd, while children (which
+ *   start with the original signal mask) inherit the ignored disposition.
+*******************************************************************************/
+void setInterrupts() {
+  sigset_t shellSignals;
+  sigemptyset(&shellSignals);
+  sigaddset(&shellSignals, SIGINT);
+  sigaddset(&shellSignals, SIGTSTP);
+  sigaddset(&shellSignals, SIGCHLD);
+
+  /* children start with the signal mask the shell was started with. SIGTTOU
+     is blocked too (but not read) so that the shell can hand the terminal to
+     a pipeline's process group and take it back */
+  sigset_t blockedSignals = shellSignals;
+  sigaddset(&blockedSignals, SIGTTOU);
+  sigprocmask(SIG_BLOCK, &blockedSignals, &childSignalMask);
+
+  struct sigaction SIGTSTP_action = {{0}};
+  SIGTSTP_action.sa_handler = SIG_IGN;
+  sigaction(SIGTSTP, &SIGTSTP_action, NULL);
+
+  signalFd = signalfd(-1, &shellSignals, SFD_NONBLOCK | SFD_CLOEXEC);
+  if(signalFd == -1) {
+    perror("signalfd() failed");
+    exit(1);
+  }
+
+  epollFd = epoll_create1(EPOLL_CLOEXEC);
+  if(epollFd == -1) {
+    perror("epoll_create1() failed");
+    exit(1);
+  }
+  struct epoll_event event = {0};
+  event.events = EPOLLIN;
+  event.data.fd = signalFd;
+  epoll_ctl(epollFd, EPOLL_CTL_ADD, signalFd, &event);
+
+  return;
+}
+
+
+/*******************************************************************************
+ *                          displayBGMessage
+ * Description: detects a change in the background allowed flag and displays a 
+ *   message if it has flipped
+ * Input: 
+ *   none
+ *   All of the information this function needs is stored in two global flag
+ *   variables
+ * Output:
+ *   none
+ *   displays messages to stdout
+*******************************************************************************/
+void displayBGMessage() {
+  /* if the flags are equal, then no change in background allowed state has
+     occured since a message was printed to the user. Do nothing. */
+  if(background_allowed == previous_background_allowed) {
+    return;
+  }
+
+  /* else we know the flag has flipped. Print the appropriate message and update
+     the value of previous flag */
+  else if( background_allowed == 0 ) {
+    printf("\nEntering foreground-only mode (& is now ignored)\n");
+    flushOutput();
+  }
+  else {
+    printf("\nExiting foreground-only mode\n");
+    flushOutput();
+  }
+  previous_background_allowed = background_allowed;
+}
+
+
+/*******************************************************************************
+ *                            struct Command
+ * One parsed command line. getArgs and parseArgs fill a command in and
+ * spawnProcess runs it, and everything the line asked for is kept in it, so
+ * any number of lines can be parsed and held at once: the queued jobs, the
+ * parse cache and the lines parsed ahead of time each have their own.
+ *   - words is the arena holding the words of the line
+ *   - args holds argsCapacity pointers. The first numArgs were filled in by
+ *     getArgs, and parseArgs leaves the stages separated by NULLs.
+ *   - stageStart[i] is the index in args of the first argument of stage i
+ *   - inputSharedFlag is set for <@ instead of <, and outputAppendFlag for
+ *     >> instead of >. errorToOutputFlag is set for 2>&1, and
+ *     errorRedirectionFlag for 2> or 2>> with a file, errorAppendFlag too for
+ *     2>>.
+ *   - backgroundRequested is set by a trailing '&'. backgroundFlag is set when
+ *     the command actually runs in the background, which also depends on the
+ *     mode the shell is in when it runs.
+ *   - limits holds the caps given with a leading "limit" (see parseLimit).
+ *     Each is 0 when it is not given, and set is TRUE when any is.
+ * lineCommand is the one the main loop parses a line into when it has not
+ * been parsed already.
+*******************************************************************************/
+typedef struct JobLimits {
+  int set;
+  long memory;
+  long cpuSeconds;
+  long cores;
+  long procs;
+  long files;
+} jobLimits;
+
+typedef struct Command {
+  arena words;
+  char** args;
+  int argsCapacity;
+  int numArgs;
+  int* stageStart;
+  int numStages;
+  int inputRedirectionFlag;
+  int inputSharedFlag;
+  char* inputRedirectionFileName;
+  int outputRedirectionFlag;
+  int outputAppendFlag;
+  char* outputRedirectionFileName;
+  int errorRedirectionFlag;
+  int errorAppendFlag;
+  int errorToOutputFlag;
+  char* errorRedirectionFileName;
+  int backgroundRequested;
+  int backgroundFlag;
+  int timeFlag;
+  jobLimits limits;
+} command;
+
+command lineCommand;
+
+
+/*******************************************************************************
+ *                     void clearCommand(command* cmd)
+ * Description: sets the args used by the previous line back to NULL and resets
+ *   the redirections, flags and pipeline stages. The words themselves live in
+ *   the command's arena, which is reset, so nothing is freed here and only the
+ *   slots that were actually filled are touched.
+*******************************************************************************/
+void clearCommand(command* cmd) {
+  int i;
+  for(i = 0; i < cmd->numArgs; ++i) {
+    cmd->args[i] = NULL;
+  }
+  cmd->numArgs = 0;
+  arenaReset(&cmd->words);
+  cmd->inputRedirectionFlag = 0;
+  cmd->outputRedirectionFlag = 0;
+  cmd->inputRedirectionFileName = NULL;
+  cmd->outputRedirectionFileName = NULL;
+  cmd->inputSharedFlag = 0;
+  cmd->outputAppendFlag = 0;
+  cmd->errorRedirectionFlag = 0;
+  cmd->errorAppendFlag = 0;
+  cmd->errorToOutputFlag = 0;
+  cmd->errorRedirectionFileName = NULL;
+  cmd->backgroundFlag = 0;
+  cmd->backgroundRequested = 0;
+  cmd->timeFlag = 0;
+  cmd->limits.set = FALSE;
+  cmd->numStages = 1;
+  cmd->stageStart[0] = 0;
+}
+
+
+/*******************************************************************************
+ *                   void growArgs(command* cmd, int needed)
+ * Description: doubles the capacity of args, and of stageStart with it, until
+ *   there is room for needed pointers. The new slots are set to NULL. The
+ *   capacity is kept for every later line, so a long line only costs a
+ *   reallocation the first time one that long is seen.
+*******************************************************************************/
+void growArgs(command* cmd, int needed) {
+  int oldCapacity = cmd->argsCapacity;
+  while(cmd->argsCapacity < needed) {
+    cmd->argsCapacity *= 2;
+  }
+  cmd->args = realloc(cmd->args, sizeof(char*) * cmd->argsCapacity);
+  cmd->stageStart = realloc(cmd->stageStart, sizeof(int) * cmd->argsCapacity);
+  assert(cmd->args != NULL && cmd->stageStart != NULL);
+
+  int i;
+  for(i = oldCapacity; i < cmd->argsCapacity; ++i) {
+    cmd->args[i] = NULL;
+  }
+}
+
+
+/*******************************************************************************
+ *                 void getArgs(char* promptInput, command* cmd)
+ * Description: takes the user input and splits it into individual words which
+ *   populate cmd->args when the funcion ends. The input is copied into the
+ *   command's arena and split in place by writing a '\0' over the white-space
+ *   after each word, so no memory is allocated per word. Runs of white-space
+ *   count as a single separator. There is no limit on the number or the length
+ *   of the words: args is grown as needed.
+ * Input:
+ *   - char* promptInput - a string of text containing all of the command-line 
+ *       args
+ *   - command* cmd - the command to fill in. Whatever it held is cleared.
+ * Output: none
+*******************************************************************************/
+void getArgs(char* promptInput, command* cmd) {
+  STATS_BEGIN(began);
+  int argsIndex = 0;
+
+  /* clear out the previous line before beginning */
+  clearCommand(cmd);
+
+  size_t inputLength = strlen(promptInput);
+  char* cursor = arenaAlloc(&cmd->words, inputLength + 1);
+  memcpy(cursor, promptInput, inputLength + 1);
+
+  while(*cursor != '\0') {
+    /* skip the white-space before the next word */
+    while(*cursor == ' ' || *cursor == '\t') {
+      cursor++;
+    }
+    if(*cursor == '\0') {
+      break;
+    }
+
+    /* the word begins here, leaving room for the NULL that terminates args.
+       find its end and terminate it */
+    if(argsIndex + 1 >= cmd->argsCapacity) {
+      growArgs(cmd, argsIndex + 2);
+    }
+    cmd->args[argsIndex] = cursor;
+    argsIndex += 1;
+    while(*cursor != '\0' && *cursor != ' ' && *cursor != '\t') {
+      cursor++;
+    }
+    if(*cursor != '\0') {
+      *cursor = '\0';
+      cursor++;
+    }
+  }
+
+  cmd->args[argsIndex] = NULL;
+  cmd->numArgs = argsIndex;
+  STATS_END(STAT_GETARGS, began);
+}
+
+
+/*******************************************************************************
+ *            void initializeCommand(command* cmd, int capacity)
+ * Description: allocates the args array and stageStart with room for capacity
+ *   entries, sets all pointers in args to NULL and clears the flags
+ * Input: 
+ *   command* cmd - the command to set up
+ *   int capacity - the number of args to make room for, at least 1
+ * Output: 
+ *   none
+*******************************************************************************/
+void initializeCommand(command* cmd, int capacity) {
+  assert(capacity > 0);
+  cmd->words.head = NULL;
+  cmd->argsCapacity = capacity;
+  cmd->args = malloc(sizeof(char*) * capacity);
+  cmd->stageStart = malloc(sizeof(int) * capacity);
+  assert(cmd->args != NULL && cmd->stageStart != NULL);
+
+  /* set each to NULL */
+  int i;
+  for(i = 0; i < capacity; ++i) {
+    cmd->args[i] = NULL;
+  }
+  cmd->numArgs = 0;
+  clearCommand(cmd);
+}
+
+
+/*******************************************************************************
+ *                 void copyCommand(command* from, command* to)
+ * Description: copies a parsed command, with its stages, redirections and
+ *   flags, into another one so that it outlives the line it came from. All of
+ *   the words are copied into a single allocation from to's arena.
+*******************************************************************************/
+void copyCommand(command* from, command* to) {
+  /* the stages are separated by NULLs, so count up to the end of the last */
+  int numArgs = from->stageStart[from->numStages - 1];
+  size_t wordsLength = 0;
+  while(from->args[numArgs] != NULL) {
+    numArgs++;
+  }
+  int i;
+  for(i = 0; i < numArgs; ++i) {
+    if(from->args[i] != NULL) {
+      wordsLength += strlen(from->args[i]) + 1;
+    }
+  }
+  if(from->inputRedirectionFlag) {
+    wordsLength += strlen(from->inputRedirectionFileName) + 1;
+  }
+  if(from->outputRedirectionFlag) {
+    wordsLength += strlen(from->outputRedirectionFileName) + 1;
+  }
+  if(from->errorRedirectionFlag) {
+    wordsLength += strlen(from->errorRedirectionFileName) + 1;
+  }
+
+  clearCommand(to);
+  if(numArgs + 1 > to->argsCapacity) {
+    growArgs(to, numArgs + 1);
+  }
+  char* word = arenaAlloc(&to->words, wordsLength + 1);
+  for(i = 0; i < numArgs; ++i) {
+    if(from->args[i] == NULL) {
+      continue;
+    }
+    strcpy(word, from->args[i]);
+    to->args[i] = word;
+    word += strlen(word) + 1;
+  }
+  to->numArgs = numArgs;
+
+  to->numStages = from->numStages;
+  memcpy(to->stageStart, from->stageStart, sizeof(int) * from->numStages);
+  to->inputRedirectionFlag = from->inputRedirectionFlag;
+  to->outputRedirectionFlag = from->outputRedirectionFlag;
+  to->inputSharedFlag = from->inputSharedFlag;
+  to->outputAppendFlag = from->outputAppendFlag;
+  to->errorRedirectionFlag = from->errorRedirectionFlag;
+  to->errorAppendFlag = from->errorAppendFlag;
+  to->errorToOutputFlag = from->errorToOutputFlag;
+  to->backgroundRequested = from->backgroundRequested;
+  to->backgroundFlag = from->backgroundFlag;
+  to->timeFlag = from->timeFlag;
+  to->limits = from->limits;
+  if(from->inputRedirectionFlag) {
+    strcpy(word, from->inputRedirectionFileName);
+    to->inputRedirectionFileName = word;
+    word += strlen(word) + 1;
+  }
+  if(from->outputRedirectionFlag) {
+    strcpy(word, from->outputRedirectionFileName);
+    to->outputRedirectionFileName = word;
+    word += strlen(word) + 1;
+  }
+  if(from->errorRedirectionFlag) {
+    strcpy(word, from->errorRedirectionFileName);
+    to->errorRedirectionFileName = word;
+  }
+}
+
+
+/*******************************************************************************
+ *                     void destroyCommand(command* cmd)
+ * Description: frees all memory allocated for the arguments array and the arena
+ *   holding its words
+ * Input: command* cmd - the command to free
+ * Output: none
+*******************************************************************************/
+void destroyCommand(command* cmd) {
+  clearCommand(cmd);
+  destroyArena(&cmd->words);
+  free(cmd->args);
+  free(cmd->stageStart);
+  cmd->args = NULL;
+  cmd->stageStart = NULL;
+  cmd->argsCapacity = 0;
+}
+
+/*******************************************************************************
+ *                   int isWord(char*) 
+ * Returns true if the char* is not a special argument character and if it is
+ * not null. Otherwise returns false
+*******************************************************************************/
+int isWord(char* word) {
+
+  /* if the word is empty (because either the pointer is set to null or 
+     the string is empty), return false */
+  if(word == NULL) {
+    return FALSE;
+  }
+  if(word[0] == '\0') {
+    return FALSE;
+  }
+
+  /* if the word begins with a special character, return false */
+  if(word[0] == '<' || word[0] == '>' || word[0] == '&' || word[0] == '|') {
+    if(word[1] == '\0') {
+      return FALSE;
+    }
+  }
+  if(strcmp(word, "<@") == 0 || strcmp(word, ">>") == 0 ||
+     strcmp(word, "2>") == 0 || strcmp(word, "2>>") == 0 ||
+     strcmp(word, "2>&1") == 0) {
+    return FALSE;
+  }
+
+  /* it must be a "word" for the purposes of our program. Return true */
+  return TRUE;
+}
+
+
+/*******************************************************************************
+ *         argsFilterDown(char** args,int actualIndex, int examineInex)
+ * Filters down the arguments to fill in the gaps left by file redirection
+ * commands and the like
+ * Input:
+ *   char** args - the pointer to the list of arguments (char*s)
+ *   int* actualIndex - the index at which the argument at examine index should
+ *     be placed
+ *   int* examineIndex - the index of the argument that is being moved down
+*******************************************************************************/
+void argsFilterDown(char** args, int* actualIndex, int* examineIndex) {
+  /* make sure the two arguments are not the same. The argument being replaced
+     lives in the command's arena, so it does not need to be freed */
+  if (args[*actualIndex] != args[*examineIndex]) {
+    /* perform the swap and */
+    args[*actualIndex] = args[*examineIndex];
+    args[*examineIndex] = NULL;
+  }
+  /* increment both indices */
+  *actualIndex += 1;
+  *examineIndex += 1;
+}
+
+
+/*******************************************************************************
+ *            unsigned long hashBytes(char* bytes, size_t length)
+ * Description: FNV-1a hash of the first length characters of bytes
+*******************************************************************************/
+unsigned long hashBytes(char* bytes, size_t length) {
+  unsigned long hash = 14695981039346656037UL;
+  size_t i;
+  for(i = 0; i < length; ++i) {
+    hash ^= (unsigned char)bytes[i];
+    hash *= 1099511628211UL;
+  }
+  return hash;
+}
+
+
+/*******************************************************************************
+ *                         struct Results
+ * A struct to hold the code and a boolean value indicating whether the previous
+ * process was terminated by signal or not
+*******************************************************************************/
+typedef struct Results {
+  int code;
+  int sig;
+} result;
+
+
+/*******************************************************************************
+ *                 unsigned long hashString(char* string)
+ * Description: FNV-1a hash of a null-terminated string
+*******************************************************************************/
+unsigned long hashString(char* string) {
+  return hashBytes(string, strlen(string));
+}
+
+
+/*******************************************************************************
+ *                        struct VariableTable
+ * The shell's variables. It is an open-addressed hash table with linear
+ * probing that is filled from environ when the shell starts, so a lookup never
+ * has to scan the environment. Exported variables are also kept in environ
+ * with setenv() so that the commands the shell runs inherit them.
+*******************************************************************************/
+typedef struct ShellVariable {
+  char* name;
+  char* value;
+  int exported;
+} shellVariable;
+
+typedef struct VariableTable {
+  int loaded;
+  int capacity;
+  int size;
+  shellVariable* entries;
+} variableTable;
+
+variableTable shellVariables = {FALSE, 0, 0, NULL};
+
+
+/*******************************************************************************
+ *                 int variableFind(char* name, int length)
+ * Description: finds the slot holding the variable whose name is the first
+ *   length characters of name, or the empty slot where it would be inserted.
+ *   The name does not need to be null-terminated, so a name can be looked up
+ *   in the middle of the word it appears in.
+ * Output: index into shellVariables.entries
+*******************************************************************************/
+int variableFind(char* name, int length) {
+  int mask = shellVariables.capacity - 1;
+  int index = hashBytes(name, length) & mask;
+  while(shellVariables.entries[index].name != NULL &&
+        (strncmp(shellVariables.entries[index].name, name, length) != 0 ||
+         shellVariables.entries[index].name[length] != '\0')) {
+    index = (index + 1) & mask;
+  }
+  return index;
+}
+
+
+/*******************************************************************************
+ *          void variableStore(char* name, char* value, int exported)
+ * Description: puts a variable into the table. It is also put into the
+ *   environment if exported is TRUE or the variable was already exported. The
+ *   table is doubled once it is half full.
+*******************************************************************************/
+void variableStore(char* name, char* value, int exported) {
+  int length = strlen(name);
+
+  if(shellVariables.size * 2 >= shellVariables.capacity) {
+    shellVariable* oldEntries = shellVariables.entries;
+    int oldCapacity = shellVariables.capacity;
+    shellVariables.capacity = oldCapacity == 0 ? 64 : oldCapacity * 2;
+    shellVariables.entries = calloc(shellVariables.capacity,
+                                    sizeof(shellVariable));
+    assert(shellVariables.entries != NULL);
+
+    int i;
+    for(i = 0; i < oldCapacity; ++i) {
+      if(oldEntries[i].name != NULL) {
+        int slot = variableFind(oldEntries[i].name, strlen(oldEntries[i].name));
+        shellVariables.entries[slot] = oldEntries[i];
+      }
+    }
+    free(oldEntries);
+  }
+
+  shellVariable* variable = &shellVariables.entries[variableFind(name, length)];
+  if(variable->name == NULL) {
+    variable->name = strdup(name);
+    variable->exported = FALSE;
+    shellVariables.size += 1;
+  }
+  else if(variable->value != value) {
+    free(variable->value);
+  }
+  if(variable->value != value) {
+    variable->value = strdup(value);
+  }
+  if(exported) {
+    variable->exported = TRUE;
+  }
+  if(variable->exported) {
+    setenv(name, value, 1);
+  }
+}
+
+
+/*******************************************************************************
+ *                         void loadVariables()
+ * Description: copies the environment into the shell's variables, all of
+ *   them exported. This is done the first time a variable is looked up or
+ *   set rather than at startup, so a shell that never uses one does not copy
+ *   the environment at all.
+*******************************************************************************/
+void loadVariables() {
+  char** entry;
+  if(shellVariables.loaded) {
+    return;
+  }
+  shellVariables.loaded = TRUE;
+  for(entry = environ; *entry != NULL; ++entry) {
+    char* equals = strchr(*entry, '=');
+    if(equals == NULL || equals == *entry) {
+      continue;
+    }
+    char* name = strndup(*entry, equals - *entry);
+    assert(name != NULL);
+    variableStore(name, equals + 1, FALSE);
+    shellVariables.entries[variableFind(name, strlen(name))].exported = TRUE;
+    free(name);
+  }
+}
+
+
+/*******************************************************************************
+ *                 char* getVariable(char* name, int length)
+ * Description: looks up a shell variable, see variableFind
+ * Output: its value, or NULL if it is not set
+*******************************************************************************/
+char* getVariable(char* name, int length) {
+  loadVariables();
+  if(shellVariables.size == 0) {
+    return NULL;
+  }
+  return shellVariables.entries[variableFind(name, length)].value;
+}
+
+
+/*******************************************************************************
+ *          void setVariable(char* name, char* value, int exported)
+ * Description: sets a shell variable, see variableStore
+*******************************************************************************/
+void setVariable(char* name, char* value, int exported) {
+  loadVariables();
+  variableStore(name, value, exported);
+}
+
+
+/*******************************************************************************
+ *                        void destroyVariables()
+ * Description: frees all memory held by the shell's variables
+*******************************************************************************/
+void destroyVariables() {
+  int i;
+  for(i = 0; i < shellVariables.capacity; ++i) {
+    free(shellVariables.entries[i].name);
+    free(shellVariables.entries[i].value);
+  }
+  free(shellVariables.entries);
+  shellVariables.entries = NULL;
+  shellVariables.capacity = 0;
+  shellVariables.size = 0;
+}
+
+
+/*******************************************************************************
+ *                     int variableNameLength(char* name)
+ * Description: measures the variable name at the start of name: a letter or
+ *   '_' followed by letters, digits and '_'s
+ * Output: the length of the name, or 0 if name does not start with one
+*******************************************************************************/
+int variableNameLength(char* name) {
+  int length = 0;
+  if(!(isalpha((unsigned char)name[0]) || name[0] == '_')) {
+    return 0;
+  }
+  while(isalnum((unsigned char)name[length]) || name[length] == '_') {
+    length++;
+  }
+  return length;
+}
+
+
+/*******************************************************************************
+ *                      int isAssignment(char* word)
+ * Description: decides whether a word has the form NAME=value
+*******************************************************************************/
+int isAssignment(char* word) {
+  int length = variableNameLength(word);
+  return length > 0 && word[length] == '=';
+}
+
+
+/*******************************************************************************
+ *                    void assignVariables(char** args)
+ * Description: sets a shell variable for each NAME=value word of a command
+ *   that consists only of assignments
+*******************************************************************************/
+void assignVariables(char** args) {
+  int i;
+  for(i = 0; args[i] != NULL; ++i) {
+    char* equals = strchr(args[i], '=');
+    *equals = '\0';
+    setVariable(args[i], equals + 1, FALSE);
+    *equals = '=';
+  }
+}
+
+
+/*******************************************************************************
+ *                     void exportCommand(char** args)
+ * Description: the export built-in. "export NAME=value" sets and exports a
+ *   variable and "export NAME" exports one that is already set (or sets it to
+ *   the empty string). With no arguments the exported variables are listed.
+*******************************************************************************/
+void exportCommand(char** args, processes* procs, result* status) {
+  int i;
+  if(args[1] == NULL) {
+    loadVariables();
+    for(i = 0; i < shellVariables.capacity; ++i) {
+      if(shellVariables.entries[i].name != NULL &&
+         shellVariables.entries[i].exported) {
+        printf("export %s=%s\n", shellVariables.entries[i].name,
+               shellVariables.entries[i].value);
+      }
+    }
+    flushOutput();
+    return;
+  }
+
+  for(i = 1; args[i] != NULL; ++i) {
+    int length = variableNameLength(args[i]);
+    if(length == 0 || (args[i][length] != '=' && args[i][length] != '\0')) {
+      printf("export: %s: not a valid name\n", args[i]);
+      flushOutput();
+    }
+    else if(args[i][length] == '=') {
+      args[i][length] = '\0';
+      setVariable(args[i], args[i] + length + 1, TRUE);
+      args[i][length] = '=';
+    }
+    else {
+      char* value = getVariable(args[i], length);
+      setVariable(args[i], value == NULL ? "" : value, TRUE);
+    }
+  }
+}
+
+
+/*******************************************************************************
+ *                       char* getPidString()
+ * The pid of smallsh as a string, which is what $$ expands to. It is worked
+ * out the first time it is needed and kept, since the pid never changes.
+*******************************************************************************/
+char* getPidString() {
+  if(pidStringLength == 0) {
+    sprintf(pidString, "%d", getpid());
+    pidStringLength = getStringLength(pidString);
+  }
+  return pidString;
+}
+
+
+/*******************************************************************************
+ *     char* expansionValue(char* source, int* consumed, result* status,
+ *                          processes* procs, char* number)
+ * Description: works out what the expansion that starts with the '$' at
+ *   source is replaced by:
+ *     $$ - the pid of smallsh
+ *     $? - the exit value of the last foreground command, or 128 plus the
+ *          signal that terminated it
+ *     $! - the pid of the last background process, or nothing if there was
+ *          none
+ *     $NAME and ${NAME} - the value of the shell variable, or nothing if it
+ *          is not set
+ * Input:
+ *   - consumed - set to how many characters of source the expansion uses
+ *   - number - room for at least 24 characters to format $? or $! into
+ * Output: the replacement, or NULL if the '$' does not begin an expansion and
+ *   is to be kept as it is
+*******************************************************************************/
+char* expansionValue(char* source, int* consumed, result* status,
+                     processes* procs, char* number) {
+  char* value;
+  int length;
+
+  switch(source[1]) {
+    case '$':
+      *consumed = 2;
+      return getPidString();
+
+    case '?':
+      *consumed = 2;
+      sprintf(number, "%d", status->sig ? 128 + status->code : status->code);
+      return number;
+
+    case '!':
+      *consumed = 2;
+      number[0] = '\0';
+      if(procs->lastPid != 0) {
+        sprintf(number, "%d", procs->lastPid);
+      }
+      return number;
+
+    case '{':
+      length = variableNameLength(source + 2);
+      if(length == 0 || source[2 + length] != '}') {
+        return NULL;
+      }
+      *consumed = length + 3;
+      value = getVariable(source + 2, length);
+      return value == NULL ? "" : value;
+
+    default:
+      length = variableNameLength(source + 1);
+      if(length == 0) {
+        return NULL;
+      }
+      *consumed = length + 1;
+      value = getVariable(source + 1, length);
+      return value == NULL ? "" : value;
+  }
+}
+
+
+/*******************************************************************************
+ *  int expandWord(char** arg, arena* words, result* status, processes* procs)
+ * This function examines a string of characters for the expansions described
+ * in expansionValue and replaces every one of them, reading from left to right
+ * so that "$$$" becomes the pid followed by '$'. The length of the result is
+ * worked out first so that the new string, allocated from words, is written
+ * in a single pass. A string without expansions is left as it is.
+ * Output: TRUE if anything was expanded
+*******************************************************************************/
+int expandWord(char** arg, arena* words, result* status, processes* procs) {
+  assert(arg != NULL);
+  assert(*arg != NULL);
+  STATS_BEGIN(began);
+  char* source = *arg;
+  char number[24];
+  int expanded = FALSE;
+  int length = 0;
+  int index = 0;
+  int consumed;
+
+  /* find the length of the expanded arg */
+  while(source[index] != '\0') {
+    char* value = NULL;
+    if(source[index] == '$') {
+      value = expansionValue(source + index, &consumed, status, procs, number);
+    }
+    if(value != NULL) {
+      expanded = TRUE;
+      length += strlen(value);
+      index += consumed;
+    }
+    else {
+      length += 1;
+      index += 1;
+    }
+  }
+  if(!expanded) {
+    STATS_END(STAT_EXPAND, began);
+    return FALSE;
+  }
+
+  char* newArg = arenaAlloc(words, length + 1);
+  char* destination = newArg;
+
+  /* copy the arg, writing the value of each expansion in its place */
+  while(*source != '\0') {
+    char* value = NULL;
+    if(*source == '$') {
+      value = expansionValue(source, &consumed, status, procs, number);
+    }
+    if(value != NULL) {
+      size_t valueLength = strlen(value);
+      memcpy(destination, value, valueLength);
+      destination += valueLength;
+      source += consumed;
+    }
+    else {
+      *destination = *source;
+      destination += 1;
+      source += 1;
+    }
+  }
+  *destination = '\0';
+
+  /* rearrange the pointers to replace old arg with new arg */
+  *arg = newArg;
+  STATS_END(STAT_EXPAND, began);
+  return TRUE;
+}
+
+
+/*******************************************************************************
+ *             int parseLimit(char* word, jobLimits* limits)
+ * Description: reads one KEY=VALUE word given to "limit" into limits:
+ *     mem=SIZE   - memory, in bytes or with a K, M, G or T suffix
+ *     cpu=N      - CPU time in seconds
+ *     cores=N    - CPU time per period as a number of CPUs, such as 0.5 or 2
+ *     procs=N    - processes
+ *     files=N    - open files
+ * Output: FALSE if word is not one of these with a valid value
+*******************************************************************************/
+int parseLimit(char* word, jobLimits* limits) {
+  char* value = strchr(word, '=');
+  char* end;
+  if(value == NULL || value[1] == '\0') {
+    return FALSE;
+  }
+  value++;
+
+  if(strncmp(word, "cores=", 6) == 0) {
+    double cores = strtod(value, &end);
+    if(*end != '\0' || cores <= 0) {
+      return FALSE;
+    }
+    limits->cores = (long)(cores * 100000);
+    return limits->cores > 0;
+  }
+
+  errno = 0;
+  long number = strtol(value, &end, 10);
+  if(number <= 0 || errno == ERANGE) {
+    return FALSE;
+  }
+  if(strncmp(word, "mem=", 4) == 0) {
+    static const char units[] = "KMGT";
+    char* suffix = *end == '\0' ? NULL :
+                   strchr(units, toupper((unsigned char)*end));
+    if(*end != '\0' && (suffix == NULL || end[1] != '\0')) {
+      return FALSE;
+    }
+    int shift = suffix == NULL ? 0 : 10 * (int)(suffix - units + 1);
+    if(number > LONG_MAX >> shift) {
+      return FALSE;
+    }
+    limits->memory = number << shift;
+    return TRUE;
+  }
+  if(*end != '\0') {
+    return FALSE;
+  }
+  if(strncmp(word, "cpu=", 4) == 0) {
+    limits->cpuSeconds = number;
+  }
+  else if(strncmp(word, "procs=", 6) == 0) {
+    limits->procs = number;
+  }
+  else if(strncmp(word, "files=", 6) == 0) {
+    limits->files = number;
+  }
+  else {
+    return FALSE;
+  }
+  return TRUE;
+}
+
+
+/*******************************************************************************
+ *        void parseArgs(command* cmd, result* status, processes* procs)
+ * Description: This function examines the list of arguments and does two things
+ *   1) Looks for special operators - such as file redirection or background
+ *      commands. In which case it sets the command's flags and file names. A
+ *      '|' between two commands ends one stage of a pipeline: it is replaced
+ *      by the NULL that terminates that stage's arguments and stageStart
+ *      records where the next stage begins. '<' (or '<@', which shares the
+ *      file) applies to the first stage of a pipeline and '>' (or '>>', which
+ *      appends) to the last. '2>' (or '2>>', which appends) and
+ *      '2>&1' send the standard error of every stage to a file or to
+ *      wherever that stage's standard output goes.
+ *   2) Expands the arguments and the redirection file names with expandWord.
+ *      An argument that expands to nothing is dropped.
+ *   3) Removes a leading "time", setting timeFlag instead, and then a leading
+ *      "limit" with its KEY=VALUE words, which are read into limits. The
+ *      limits are given literally, they are not expanded.
+ *   4) Rearranges the arguments in args to move filter relevent commands down
+ *      torwards args[0] as the special operators and their arguments are
+ *      removed
+ * Input:
+ *   command* cmd - the command filled in by getArgs
+ *   result* status - the exit status $? expands to
+ *   processes* procs - the background processes, for $!
+ * Output:
+ *   none.
+ *   modifies cmd
+*******************************************************************************/
+void parseArgs(command* cmd, result* status, processes* procs) {
+  STATS_BEGIN(began);
+  char** args = cmd->args;
+  int examineIndex = 0;
+  int actualIndex = 0;
+
+  /* a leading "time" asks for the command's times to be reported */
+  if(args[0] != NULL && strcmp(args[0], "time") == 0 && args[1] != NULL) {
+    cmd->timeFlag = TRUE;
+    examineIndex = 1;
+  }
+
+  /* "limit" is only taken as a prefix when a valid limit and a command to
+     apply it to follow it */
+  if(args[examineIndex] != NULL && strcmp(args[examineIndex], "limit") == 0) {
+    jobLimits limits = {0};
+    int limitIndex = examineIndex + 1;
+    while(args[limitIndex] != NULL && parseLimit(args[limitIndex], &limits)) {
+      limitIndex++;
+    }
+    if(limitIndex > examineIndex + 1 && args[limitIndex] != NULL) {
+      cmd->limits = limits;
+      cmd->limits.set = TRUE;
+      examineIndex = limitIndex;
+    }
+  }
+  
+  while(args[examineIndex] != NULL) {
+
+    /* if args at examine index is '<' or '<@', then set file redirection
+       input */
+    if(strcmp(args[examineIndex], "<") == 0 ||
+       strcmp(args[examineIndex], "<@") == 0) {
+      if(isWord(args[examineIndex + 1])) {
+        /* then examineIndex + 1 is the name of a file for file input 
+           redirection. Set the flags and save the file name*/
+        cmd->inputRedirectionFlag = 1;
+        cmd->inputSharedFlag = args[examineIndex][1] == '@';
+        expandWord(&args[examineIndex + 1], &cmd->words, status, procs);
+        cmd->inputRedirectionFileName = args[examineIndex + 1];
+
+        /* rearrange current working indecies */
+        examineIndex += 2;
+      }
+      /* if the next argument is not a minimally valid word, then we will treat
+         this special character as a regular argument. */
+      else {
+        argsFilterDown(args, &actualIndex, &examineIndex);
+      }
+    }
+
+    /* if args at examine index is '>' or '>>', then set file redirection
+       output */
+    else if (strcmp(args[examineIndex], ">") == 0 ||
+             strcmp(args[examineIndex], ">>") == 0) {
+      if(isWord(args[examineIndex + 1])) {
+        /* then examineIndex + 1 is the name of a file for file output 
+           redirection. Set the flags and save the file name*/
+        cmd->outputRedirectionFlag = 1;
+        cmd->outputAppendFlag = args[examineIndex][1] == '>';
+        expandWord(&args[examineIndex + 1], &cmd->words, status, procs);
+        cmd->outputRedirectionFileName = args[examineIndex + 1];
+
+        /* rearrange current working indecies */
+        examineIndex += 2;
+      }
+      /* if the next argument is not a minimally valid word, then we will treat
+         this special character as a regular argument. */
+      else {
+        argsFilterDown(args, &actualIndex, &examineIndex);
+      }
+    }
+
+    /* if args at examine index is '2>' or '2>>', then set file redirection
+       of the standard error. the last of these and 2>&1 wins */
+    else if (strcmp(args[examineIndex], "2>") == 0 ||
+             strcmp(args[examineIndex], "2>>") == 0) {
+      if(isWord(args[examineIndex + 1])) {
+        cmd->errorRedirectionFlag = 1;
+        cmd->errorAppendFlag = args[examineIndex][2] == '>';
+        cmd->errorToOutputFlag = 0;
+        expandWord(&args[examineIndex + 1], &cmd->words, status, procs);
+        cmd->errorRedirectionFileName = args[examineIndex + 1];
         examineIndex += 2;
       }
-      /* if the next argument is not a minimally valid word, then we will treat
-         this special character as a regular argument. */
-      else {
-        argsFilterDown(args, &actualIndex, &examineIndex);
+      else {
+        argsFilterDown(args, &actualIndex, &examineIndex);
+      }
+    }
+
+    /* if args at examine index is '2>&1', the standard error follows the
+       standard output */
+    else if (strcmp(args[examineIndex], "2>&1") == 0) {
+      cmd->errorToOutputFlag = 1;
+      cmd->errorRedirectionFlag = 0;
+      cmd->errorAppendFlag = 0;
+      cmd->errorRedirectionFileName = NULL;
+      examineIndex += 1;
+    }
+    /* if args at examine index is '|' and it comes between two commands,
+       end the current stage of the pipeline */
+    else if (strcmp(args[examineIndex], "|") == 0 &&
+             actualIndex > cmd->stageStart[cmd->numStages - 1] &&
+             isWord(args[examineIndex + 1])) {
+      args[actualIndex] = NULL;
+      actualIndex += 1;
+      examineIndex += 1;
+      cmd->stageStart[cmd->numStages] = actualIndex;
+      cmd->numStages += 1;
+    }
+
+    /* if args at examine index is '&', then set background flag */
+    else if (strcmp(args[examineIndex], "&") == 0) {
+      /* if the & is the last argument, set the background flag */
+      if(args[examineIndex + 1] == NULL) {
+        cmd->backgroundRequested = TRUE;
+        cmd->backgroundFlag = background_allowed;
+        examineIndex += 1;
+      }
+      /* if it isn't the last argument, treat it like a normal argument */
+      else {
+        argsFilterDown(args, &actualIndex, &examineIndex);
+      }
+    }
+
+    /* else, the current argument being analyzed should be treated as a regular
+       argument. Filter it down to its spot in args */
+    else {
+      /* expand the argument, and leave it out if nothing is left of it */
+      if(expandWord(&args[examineIndex], &cmd->words, status, procs) &&
+         args[examineIndex][0] == '\0') {
+        examineIndex += 1;
+      }
+      else {
+        argsFilterDown(args, &actualIndex, &examineIndex);
+      }
+    }
+  }
+  args[actualIndex] = NULL;
+  STATS_END(STAT_PARSE, began);
+}
+
+
+/*******************************************************************************
+ *   void parseLine(char* line, command* cmd, result* status, processes* procs)
+ * Description: the whole parse of one line: getArgs splits it into cmd and
+ *   parseArgs then parses and expands the words. This is everything that
+ *   happens to a line before the shell decides how to run it, and it needs
+ *   nothing from main(), so the parse can be driven on its own with
+ *   SMALLSH_NO_MAIN (as bench.c does).
+ * Input: the line (which is not changed) and the exit status and background
+ *   processes $? and $! expand from. cmd must have been initialized.
+*******************************************************************************/
+void parseLine(char* line, command* cmd, result* status, processes* procs) {
+  getArgs(line, cmd);
+  parseArgs(cmd, status, procs);
+}
+
+
+/*******************************************************************************
+ *                       void changeDirectory(char* path)
+ * Changes the directory to the path name specified
+*******************************************************************************/
+void changeDirectory(char* path) {
+  if(path == NULL) {
+    chdir(getenv("HOME"));
+  }
+  else {
+    chdir(path);
+  }
+}
+
+
+/*******************************************************************************
+ *                        struct PathCache
+ * Remembers where each command name was found on PATH so that the search is
+ * only done the first time a command is run. It is an open-addressed hash table
+ * with linear probing. The value of PATH the entries were resolved against is
+ * kept so that the cache can be dropped when PATH changes.
+*******************************************************************************/
+typedef struct CommandPath {
+  char* name;
+  char* path;
+  int hits;
+} commandPath;
+
+typedef struct PathCache {
+  int capacity;
+  int size;
+  commandPath* entries;
+  char* pathValue;
+} pathCache;
+
+pathCache commandCache = {0, 0, NULL, NULL};
+
+
+/*******************************************************************************
+ *                       void pathCacheClear()
+ * Description: forgets every remembered command location
+*******************************************************************************/
+void pathCacheClear() {
+  int i;
+  for(i = 0; i < commandCache.capacity; ++i) {
+    if(commandCache.entries[i].name != NULL) {
+      free(commandCache.entries[i].name);
+      free(commandCache.entries[i].path);
+      commandCache.entries[i].name = NULL;
+      commandCache.entries[i].path = NULL;
+    }
+  }
+  commandCache.size = 0;
+}
+
+
+/*******************************************************************************
+ *                       void destroyPathCache()
+ * Description: frees all memory held by the command location cache
+*******************************************************************************/
+void destroyPathCache() {
+  pathCacheClear();
+  free(commandCache.entries);
+  free(commandCache.pathValue);
+  commandCache.entries = NULL;
+  commandCache.pathValue = NULL;
+  commandCache.capacity = 0;
+}
+
+
+/*******************************************************************************
+ *                    int pathCacheFind(char* name)
+ * Description: finds the slot holding name, or the empty slot where it would
+ *   be inserted
+ * Output: index into commandCache.entries
+*******************************************************************************/
+int pathCacheFind(char* name) {
+  int mask = commandCache.capacity - 1;
+  int index = hashString(name) & mask;
+  while(commandCache.entries[index].name != NULL &&
+        strcmp(commandCache.entries[index].name, name) != 0) {
+    index = (index + 1) & mask;
+  }
+  return index;
+}
+
+
+/*******************************************************************************
+ *               void pathCacheInsert(char* name, char* path)
+ * Description: remembers that name is found at path. The table is doubled once
+ *   it is half full.
+*******************************************************************************/
+void pathCacheInsert(char* name, char* path) {
+  if(commandCache.size * 2 >= commandCache.capacity) {
+    commandPath* oldEntries = commandCache.entries;
+    int oldCapacity = commandCache.capacity;
+    commandCache.capacity = oldCapacity == 0 ? 32 : oldCapacity * 2;
+    commandCache.entries = calloc(commandCache.capacity, sizeof(commandPath));
+    assert(commandCache.entries != NULL);
+
+    int i;
+    for(i = 0; i < oldCapacity; ++i) {
+      if(oldEntries[i].name != NULL) {
+        commandCache.entries[pathCacheFind(oldEntries[i].name)] = oldEntries[i];
+      }
+    }
+    free(oldEntries);
+  }
+
+  int index = pathCacheFind(name);
+  if(commandCache.entries[index].name == NULL) {
+    commandCache.entries[index].name = strdup(name);
+    commandCache.size += 1;
+  }
+  else {
+    free(commandCache.entries[index].path);
+  }
+  commandCache.entries[index].path = strdup(path);
+  commandCache.entries[index].hits = 0;
+}
+
+
+/*******************************************************************************
+ *                    void pathCacheRemove(char* name)
+ * Description: forgets the location of name. The entries after it in the same
+ *   probe run are shifted back so that no lookups are broken by the gap.
+*******************************************************************************/
+void pathCacheRemove(char* name) {
+  if(commandCache.capacity == 0) {
+    return;
+  }
+  int mask = commandCache.capacity - 1;
+  int hole = pathCacheFind(name);
+  if(commandCache.entries[hole].name == NULL) {
+    return;
+  }
+  free(commandCache.entries[hole].name);
+  free(commandCache.entries[hole].path);
+  commandCache.entries[hole].name = NULL;
+  commandCache.entries[hole].path = NULL;
+  commandCache.size -= 1;
+
+  int index = (hole + 1) & mask;
+  while(commandCache.entries[index].name != NULL) {
+    int home = hashString(commandCache.entries[index].name) & mask;
+    /* move the entry into the hole if its home slot is not between the hole
+       and its current position */
+    if(((index - home) & mask) >= ((index - hole) & mask)) {
+      commandCache.entries[hole] = commandCache.entries[index];
+      commandCache.entries[index].name = NULL;
+      commandCache.entries[index].path = NULL;
+      hole = index;
+    }
+    index = (index + 1) & mask;
+  }
+}
+
+
+/*******************************************************************************
+ *                    void pathCacheCheckPath()
+ * Description: drops the cache if PATH has changed since it was filled
+*******************************************************************************/
+void pathCacheCheckPath() {
+  char* path = getVariable("PATH", 4);
+  if(path == NULL) {
+    path = DEFAULT_PATH;
+  }
+  if(commandCache.pathValue == NULL ||
+     strcmp(commandCache.pathValue, path) != 0) {
+    pathCacheClear();
+    free(commandCache.pathValue);
+    commandCache.pathValue = strdup(path);
+  }
+}
+
+
+/*******************************************************************************
+ *                   char* resolveCommand(char* name)
+ * Description: finds the file that will be executed for a command name. Names
+ *   containing a '/' are used as they are. Otherwise the cache is consulted
+ *   and, on a miss, each directory of PATH is searched for an executable
+ *   regular file. Matches found through a relative PATH directory are not
+ *   remembered since they change with the working directory.
+ * Input: char* name - args[0] of the command
+ * Output: the path to execute, which stays valid until the next call, or NULL
+ *   if the command was not found
+*******************************************************************************/
+char* resolveCommand(char* name) {
+  static char* candidate = NULL;
+  static size_t candidateSize = 0;
+
+  if(strchr(name, '/') != NULL) {
+    return name;
+  }
+
+  pathCacheCheckPath();
+  if(commandCache.size > 0) {
+    int index = pathCacheFind(name);
+    if(commandCache.entries[index].name != NULL) {
+      commandCache.entries[index].hits += 1;
+      return commandCache.entries[index].path;
+    }
+  }
+
+  size_t nameLength = strlen(name);
+  char* directory = commandCache.pathValue;
+  while(TRUE) {
+    /* an empty element of PATH means the current directory */
+    size_t directoryLength = strcspn(directory, ":");
+    if(candidateSize < directoryLength + nameLength + 3) {
+      candidateSize = directoryLength + nameLength + 3;
+      candidate = realloc(candidate, candidateSize);
+      assert(candidate != NULL);
+    }
+    if(directoryLength == 0) {
+      strcpy(candidate, "./");
+    }
+    else {
+      memcpy(candidate, directory, directoryLength);
+      candidate[directoryLength] = '/';
+      candidate[directoryLength + 1] = '\0';
+    }
+    strcat(candidate, name);
+
+    struct stat fileInfo;
+    if(stat(candidate, &fileInfo) == 0 && S_ISREG(fileInfo.st_mode) &&
+       access(candidate, X_OK) == 0) {
+      if(candidate[0] != '/') {
+        return candidate;
+      }
+      pathCacheInsert(name, candidate);
+      int index = pathCacheFind(name);
+      commandCache.entries[index].hits = 1;
+      return commandCache.entries[index].path;
+    }
+
+    if(directory[directoryLength] == '\0') {
+      return NULL;
+    }
+    directory += directoryLength + 1;
+  }
+}
+
+
+/*******************************************************************************
+ *                     void hashCommand(char** args)
+ * Description: the hash built-in. With no arguments it lists the remembered
+ *   commands and how often each was used. "hash -r" empties the cache, and
+ *   "hash name..." looks up and remembers each name.
+*******************************************************************************/
+void hashCommand(char** args, processes* procs, result* status) {
+  pathCacheCheckPath();
+
+  if(args[1] == NULL) {
+    if(commandCache.size == 0) {
+      printf("hash: hash table empty\n");
+    }
+    else {
+      printf("hits\tcommand\n");
+      int i;
+      for(i = 0; i < commandCache.capacity; ++i) {
+        if(commandCache.entries[i].name != NULL) {
+          printf("%4d\t%s\n", commandCache.entries[i].hits,
+                 commandCache.entries[i].path);
+        }
+      }
+    }
+    flushOutput();
+    return;
+  }
+
+  if(strcmp(args[1], "-r") == 0) {
+    pathCacheClear();
+    return;
+  }
+
+  int i;
+  for(i = 1; args[i] != NULL; ++i) {
+    if(strchr(args[i], '/') != NULL) {
+      continue;
+    }
+    /* look the name up again even if it is already known */
+    pathCacheRemove(args[i]);
+    if(resolveCommand(args[i]) == NULL) {
+      printf("hash: %s: not found\n", args[i]);
+      flushOutput();
+    }
+    else if(commandCache.size > 0) {
+      int index = pathCacheFind(args[i]);
+      if(commandCache.entries[index].name != NULL) {
+        commandCache.entries[index].hits = 0;
+      }
+    }
+  }
+}
+
+
+/*******************************************************************************
+ *                        void loadSettings()
+ * Description: reads the shell's settings from the environment:
+ *   SMALLSH_SPAWN - chooses how child processes are launched. posix_spawn() is
+ *     used by default because it does not copy the shell's address space.
+ *     "fork" switches back to fork() + exec().
+ *   SMALLSH_PIPE_SIZE - if set, the buffer of every pipe between the stages of
+ *     a pipeline is resized to this many bytes with F_SETPIPE_SZ. Larger pipes
+ *     mean fewer context switches for high-throughput stages.
+ *   SMALLSH_TIMING - if set to 1, every command reports its times as if it had
+ *     been prefixed with "time".
+ *   SMALLSH_STATS_FILE - where the statistics are written as JSON when the
+ *     shell exits, if it was built with SMALLSH_STATS.
+ *   SMALLSH_TRACE - a file to write a trace of every command to, see traceOpen
+ *   SMALLSH_CGROUP - a cgroup v2 directory in which limited jobs get cgroups
+ *     of their own, see the job limits
+*******************************************************************************/
+void loadSettings() {
+  char* mode = getenv("SMALLSH_SPAWN");
+  if(mode != NULL && strcmp(mode, "fork") == 0) {
+    spawnMode = SPAWN_FORK;
+  }
+  else {
+    spawnMode = SPAWN_POSIX;
+  }
+
+  char* size = getenv("SMALLSH_PIPE_SIZE");
+  pipeSize = size == NULL ? 0 : atoi(size);
+
+  char* timing = getenv("SMALLSH_TIMING");
+  timingAll = timing != NULL && strcmp(timing, "1") == 0;
+
+  statsFileName = getenv("SMALLSH_STATS_FILE");
+
+  char* cgroup = getenv("SMALLSH_CGROUP");
+  cgroupRoot = cgroup != NULL && cgroup[0] != '\0' ? cgroup : NULL;
+
+  char* traceFile = getenv("SMALLSH_TRACE");
+  if(traceFile != NULL && traceFile[0] != '\0' && traceFd == -1) {
+    traceOpen(traceFile);
+  }
+}
+
+
+/*******************************************************************************
+ *               void printExecError(char* command, int error)
+ * Description: prints the message shown when a command cannot be executed, in
+ *   the form "command: no such file or directory"
+*******************************************************************************/
+void printExecError(char* command, int error) {
+  char errorString[100];
+  memset(errorString, '\0', 100);
+  strncpy(errorString, strerror(error), 99);
+  errorString[0] += 32;
+  printf("%s: %s\n", command, errorString);
+  flushOutput();
+}
+
+
+/*******************************************************************************
+ *                         struct SharedInput
+ * The files read with <@. The first time a file is read this way its contents
+ * are copied into a memfd, which is sealed so that it can no longer change,
+ * and every later command reading the file is handed the memfd instead of
+ * opening the file again, so any number of jobs share the one copy in memory.
+ * Each command gets a descriptor of its own, opened through /proc/self/fd,
+ * because a dup would share one file offset between all of the jobs reading
+ * it. The file itself is kept open in source, and it is that descriptor that
+ * is checked with fstat each time, rather than the name being looked up
+ * again. A file that has changed is copied again, and one that no longer has
+ * a name (deleted, or replaced by a rename) is dropped and opened afresh. So
+ * each entry holds two descriptors as well as the copy of the file.
+ * SHARED_INPUT_SIZE files are kept, the one used longest ago making way for a
+ * new one. Only files of up to SHARED_INPUT_MAX_SIZE bytes are copied, so the
+ * copies never hold more than SHARED_INPUT_SIZE times that. A larger file is
+ * read directly, as with <.
+*******************************************************************************/
+typedef struct SharedInput {
+  char* name;
+  int fd;
+  int source;
+  off_t size;
+  struct timespec modified;
+  unsigned long used;
+} sharedInput;
+
+sharedInput sharedInputs[SHARED_INPUT_SIZE];
+int numSharedInputs = 0;
+unsigned long sharedInputClock = 0;
+
+
+/*******************************************************************************
+ *     int sharedInputCopy(int file, struct stat* fileInfo, sharedInput* entry)
+ * Description: copies the open file, whose attributes are fileInfo, into a new
+ *   sealed memfd for entry. The offset of file is not moved.
+ * Output: TRUE, or FALSE with errno set if the file could not be copied
+*******************************************************************************/
+int sharedInputCopy(int file, struct stat* fileInfo, sharedInput* entry) {
+  int memory = memfd_create("smallsh-input", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  int copied = memory != -1;
+
+  /* the kernel copies the file across without it passing through the shell */
+  off_t offset = 0;
+  while(copied && offset < fileInfo->st_size) {
+    ssize_t written = sendfile(memory, file, &offset,
+                               fileInfo->st_size - offset);
+    if(written == 0 || (written == -1 && errno != EINTR)) {
+      copied = FALSE;
+    }
+  }
+  if(!copied) {
+    int error = errno;
+    if(memory != -1) {
+      close(memory);
+    }
+    errno = error;
+    return FALSE;
+  }
+  fcntl(memory, F_ADD_SEALS,
+        F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+
+  entry->fd = memory;
+  entry->size = fileInfo->st_size;
+  entry->modified = fileInfo->st_mtim;
+  return TRUE;
+}
+
+
+/*******************************************************************************
+ *                 void sharedInputDrop(sharedInput* entry)
+ * Description: forgets an entry, the last one taking its place. Its source is
+ *   left open for the caller to close.
+*******************************************************************************/
+void sharedInputDrop(sharedInput* entry) {
+  close(entry->fd);
+  free(entry->name);
+  *entry = sharedInputs[numSharedInputs - 1];
+  numSharedInputs -= 1;
+}
+
+
+/*******************************************************************************
+ *                  int openSharedInput(char* fileName)
+ * Description: opens a file named with <@, copying it into a memfd the first
+ *   time and whenever it has changed. A file that is not a regular file, is
+ *   too large or cannot be copied is read directly instead, as is the file
+ *   when the memfd cannot be reopened.
+ * Output: a descriptor (with O_CLOEXEC) reading from the start of the file, or
+ *   -1 if it could not be opened
+*******************************************************************************/
+int openSharedInput(char* fileName) {
+  struct stat fileInfo;
+  sharedInput* entry = NULL;
+  int i;
+  for(i = 0; i < numSharedInputs; ++i) {
+    if(strcmp(sharedInputs[i].name, fileName) == 0) {
+      entry = &sharedInputs[i];
+      break;
+    }
+  }
+
+  /* a file that has lost its name is no longer the one the name means */
+  if(entry != NULL && (fstat(entry->source, &fileInfo) == -1 ||
+                       fileInfo.st_nlink == 0)) {
+    close(entry->source);
+    sharedInputDrop(entry);
+    entry = NULL;
+  }
+  if(entry != NULL && (entry->size != fileInfo.st_size ||
+                       entry->modified.tv_sec != fileInfo.st_mtim.tv_sec ||
+                       entry->modified.tv_nsec != fileInfo.st_mtim.tv_nsec)) {
+    close(entry->fd);
+    if(fileInfo.st_size > SHARED_INPUT_MAX_SIZE ||
+       !sharedInputCopy(entry->source, &fileInfo, entry)) {
+      /* the file is handed over rather than read through a memfd */
+      int file = entry->source;
+      entry->fd = -1;
+      sharedInputDrop(entry);
+      return file;
+    }
+  }
+
+  /* a new file takes a free entry, or else the entry used longest ago */
+  if(entry == NULL) {
+    int file = open(fileName, O_RDONLY | O_CLOEXEC);
+    if(file == -1) {
+      return -1;
+    }
+    if(fstat(file, &fileInfo) == -1 || !S_ISREG(fileInfo.st_mode) ||
+       fileInfo.st_size > SHARED_INPUT_MAX_SIZE) {
+      return file;
+    }
+    if(numSharedInputs == SHARED_INPUT_SIZE) {
+      entry = &sharedInputs[0];
+      for(i = 1; i < numSharedInputs; ++i) {
+        if(sharedInputs[i].used < entry->used) {
+          entry = &sharedInputs[i];
+        }
+      }
+      close(entry->source);
+      sharedInputDrop(entry);
+    }
+    entry = &sharedInputs[numSharedInputs];
+    if(!sharedInputCopy(file, &fileInfo, entry)) {
+      return file;
+    }
+    entry->source = file;
+    entry->name = strdup(fileName);
+    assert(entry->name != NULL);
+    numSharedInputs += 1;
+  }
+  sharedInputClock += 1;
+  entry->used = sharedInputClock;
+
+  char path[32];
+  sprintf(path, "/proc/self/fd/%d", entry->fd);
+  int file = open(path, O_RDONLY | O_CLOEXEC);
+  if(file == -1) {
+    file = open(fileName, O_RDONLY | O_CLOEXEC);
+  }
+  return file;
+}
+
+
+/*******************************************************************************
+ *                      void destroySharedInputs()
+ * Description: closes the memfds of the files read with <@, and the files
+ *   themselves
+*******************************************************************************/
+void destroySharedInputs() {
+  int i;
+  for(i = 0; i < numSharedInputs; ++i) {
+    close(sharedInputs[i].fd);
+    close(sharedInputs[i].source);
+    free(sharedInputs[i].name);
+  }
+  numSharedInputs = 0;
+}
+
+
+/*******************************************************************************
+ *                     void closeRedirection(int file)
+ * Description: closes a descriptor opened by openRedirections. -1 and the
+ *   shell's /dev/null, which is kept open for every command, are left alone.
+*******************************************************************************/
+void closeRedirection(int file) {
+  if(file != -1 && file != devNullFd) {
+    close(file);
+  }
+}
+
+
+/*******************************************************************************
+ *  int openRedirections(command* cmd, int* inputFile, int* outputFile,
+ *                       int* errorFile)
+ * Description: opens the files the command names with <, <@, >, >>, 2> and 2>>
+ *   with O_CLOEXEC. A background command without < or > reads from and
+ *   writes to /dev/null, which the shell opens once and keeps. The shell
+ *   opens the files before any child is started, so a file that cannot be
+ *   opened is reported before any process exists.
+ * Output: FALSE if a file could not be opened. *inputFile, *outputFile and
+ *   *errorFile are set to the descriptors, or -1 where the shell's own is
+ *   inherited. *errorFile is ERROR_TO_OUTPUT for 2>&1.
+*******************************************************************************/
+int openRedirections(command* cmd, int* inputFile, int* outputFile,
+                     int* errorFile) {
+  *inputFile = -1;
+  *outputFile = -1;
+  *errorFile = cmd->errorToOutputFlag ? ERROR_TO_OUTPUT : -1;
+
+  if(cmd->backgroundFlag && devNullFd == -1) {
+    devNullFd = open("/dev/null", O_RDWR | O_CLOEXEC);
+  }
+
+  /* set input redirection */
+  if(cmd->inputRedirectionFlag) {
+    *inputFile = cmd->inputSharedFlag ?
+                 openSharedInput(cmd->inputRedirectionFileName) :
+                 open(cmd->inputRedirectionFileName, O_RDONLY | O_CLOEXEC);
+    if(*inputFile == -1) {
+      printf("cannot open %s for input\n", cmd->inputRedirectionFileName);
+      flushOutput();
+      return FALSE;
+    }
+  }
+  else if(cmd->backgroundFlag) {
+    *inputFile = devNullFd;
+  }
+
+  /* set output redirection */
+  if(cmd->outputRedirectionFlag) {
+    int mode = cmd->outputAppendFlag ? O_APPEND : O_TRUNC;
+    *outputFile = open(cmd->outputRedirectionFileName,
+                       O_WRONLY | O_CREAT | mode | O_CLOEXEC, 0666);
+    if(*outputFile == -1) {
+      printf("cannot open %s for output\n", cmd->outputRedirectionFileName);
+      flushOutput();
+      closeRedirection(*inputFile);
+      return FALSE;
+    }
+  }
+  else if(cmd->backgroundFlag) {
+    *outputFile = devNullFd;
+  }
+
+  /* set error redirection */
+  if(cmd->errorRedirectionFlag) {
+    int mode = cmd->errorAppendFlag ? O_APPEND : O_TRUNC;
+    *errorFile = open(cmd->errorRedirectionFileName,
+                      O_WRONLY | O_CREAT | mode | O_CLOEXEC, 0666);
+    if(*errorFile == -1) {
+      printf("cannot open %s for output\n", cmd->errorRedirectionFileName);
+      flushOutput();
+      closeRedirection(*inputFile);
+      closeRedirection(*outputFile);
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+
+/*******************************************************************************
+ *                            struct Placement
+ * The placement policy spreads background jobs over the machine, set with the
+ * place built-in:
+ *   - PLACE_NONE leaves them wherever the scheduler puts them
+ *   - PLACE_CORES gives every CPU the shell may run on a slot of its own
+ *   - PLACE_NODES gives every NUMA node a slot with the node's CPUs, and
+ *     memory is preferably allocated on the node
+ * Each background job goes to the slot with the fewest background processes
+ * running on it (the next one round when there is a tie), so with jobs-limit
+ * the jobs that start as others finish fill the slots those left. The shell
+ * moves itself onto the slot's CPUs and memory policy just while it starts
+ * the job's processes, which inherit them with either spawn mode, and then
+ * goes back to its own CPUs (shellCpus) and the default policy.
+*******************************************************************************/
+typedef struct Placement {
+  int mode;
+  int numSlots;
+  cpu_set_t* cpus;
+  int* nodes;
+  int* load;
+  int next;
+  cpu_set_t shellCpus;
+} placement;
+
+placement jobPlacement = {PLACE_NONE, 0, NULL, NULL, NULL, 0};
+
+
+/*******************************************************************************
+ *              int parseCpuList(char* list, cpu_set_t* set)
+ * Description: reads a list such as "0-3,8,10-11", the form sysfs gives CPU
+ *   and node numbers in, into set
+ * Output: FALSE if list is not such a list
+*******************************************************************************/
+int parseCpuList(char* list, cpu_set_t* set) {
+  CPU_ZERO(set);
+  while(*list != '\0' && *list != '\n') {
+    char* end;
+    long first = strtol(list, &end, 10);
+    long last = first;
+    if(end == list) {
+      return FALSE;
+    }
+    if(*end == '-') {
+      list = end + 1;
+      last = strtol(list, &end, 10);
+      if(end == list) {
+        return FALSE;
+      }
+    }
+    for(; first <= last && first < CPU_SETSIZE; ++first) {
+      CPU_SET(first, set);
+    }
+    list = *end == ',' ? end + 1 : end;
+  }
+  return TRUE;
+}
+
+
+/*******************************************************************************
+ *          int readSystemFile(char* fileName, char* text, size_t size)
+ * Description: reads a small sysfs file into text, '\0' terminated
+ * Output: FALSE if it could not be read
+*******************************************************************************/
+int readSystemFile(char* fileName, char* text, size_t size) {
+  int fd = open(fileName, O_RDONLY | O_CLOEXEC);
+  if(fd == -1) {
+    return FALSE;
+  }
+  ssize_t length = read(fd, text, size - 1);
+  close(fd);
+  if(length <= 0) {
+    return FALSE;
+  }
+  text[length] = '\0';
+  return TRUE;
+}
+
+
+/*******************************************************************************
+ *                     void placementClear()
+ * Description: turns placement off and frees the slots
+*******************************************************************************/
+void placementClear() {
+  free(jobPlacement.cpus);
+  free(jobPlacement.nodes);
+  free(jobPlacement.load);
+  jobPlacement.cpus = NULL;
+  jobPlacement.nodes = NULL;
+  jobPlacement.load = NULL;
+  jobPlacement.numSlots = 0;
+  jobPlacement.next = 0;
+  jobPlacement.mode = PLACE_NONE;
+}
+
+
+/*******************************************************************************
+ *                   void placementAddSlot(cpu_set_t* cpus, int node)
+ * Description: adds a slot for the CPUs in cpus, on NUMA node node (-1 to
+ *   keep the default memory policy)
+*******************************************************************************/
+void placementAddSlot(cpu_set_t* cpus, int node) {
+  int slot = jobPlacement.numSlots;
+  jobPlacement.cpus = realloc(jobPlacement.cpus,
+                             sizeof(cpu_set_t) * (slot + 1));
+  jobPlacement.nodes = realloc(jobPlacement.nodes, sizeof(int) * (slot + 1));
+  jobPlacement.load = realloc(jobPlacement.load, sizeof(int) * (slot + 1));
+  assert(jobPlacement.cpus != NULL && jobPlacement.nodes != NULL &&
+         jobPlacement.load != NULL);
+  jobPlacement.cpus[slot] = *cpus;
+  jobPlacement.nodes[slot] = node;
+  jobPlacement.load[slot] = 0;
+  jobPlacement.numSlots += 1;
+}
+
+
+/*******************************************************************************
+ *                     int placementSet(int mode)
+ * Description: sets up the slots of a placement mode. The CPUs are those the
+ *   shell itself may run on. Without NUMA information in sysfs the whole
+ *   machine is one node.
+ * Output: FALSE if the shell's CPUs could not be found
+*******************************************************************************/
+int placementSet(int mode) {
+  char text[4096];
+  char fileName[64];
+  cpu_set_t cpus;
+  int i;
+
+  placementClear();
+  if(mode == PLACE_NONE) {
+    return TRUE;
+  }
+  if(sched_getaffinity(0, sizeof(cpu_set_t), &jobPlacement.shellCpus) == -1) {
+    return FALSE;
+  }
+  jobPlacement.mode = mode;
+
+  if(mode == PLACE_CORES) {
+    for(i = 0; i < CPU_SETSIZE; ++i) {
+      if(CPU_ISSET(i, &jobPlacement.shellCpus)) {
+        CPU_ZERO(&cpus);
+        CPU_SET(i, &cpus);
+        placementAddSlot(&cpus, -1);
+      }
+    }
+    return TRUE;
+  }
+
+  cpu_set_t nodes;
+  if(!readSystemFile("/sys/devices/system/node/online", text, sizeof(text)) ||
+     !parseCpuList(text, &nodes)) {
+    placementAddSlot(&jobPlacement.shellCpus, -1);
+    return TRUE;
+  }
+  for(i = 0; i < CPU_SETSIZE; ++i) {
+    if(!CPU_ISSET(i, &nodes)) {
+      continue;
+    }
+    sprintf(fileName, "/sys/devices/system/node/node%d/cpulist", i);
+    if(readSystemFile(fileName, text, sizeof(text)) &&
+       parseCpuList(text, &cpus)) {
+      /* a node without any of the shell's CPUs gets no jobs */
+      CPU_AND(&cpus, &cpus, &jobPlacement.shellCpus);
+      if(CPU_COUNT(&cpus) > 0) {
+        placementAddSlot(&cpus, i);
+      }
+    }
+  }
+  if(jobPlacement.numSlots == 0) {
+    placementAddSlot(&jobPlacement.shellCpus, -1);
+  }
+  return TRUE;
+}
+
+
+/*******************************************************************************
+ *                        int placementChoose()
+ * Description: picks the slot for the next background job: the one with the
+ *   fewest background processes, starting from the slot after the last one
+ *   chosen
+ * Output: the slot, or -1 when placement is off
+*******************************************************************************/
+int placementChoose() {
+  if(jobPlacement.mode == PLACE_NONE) {
+    return -1;
+  }
+  int best = jobPlacement.next % jobPlacement.numSlots;
+  int i;
+  for(i = 1; i < jobPlacement.numSlots; ++i) {
+    int slot = (jobPlacement.next + i) % jobPlacement.numSlots;
+    if(jobPlacement.load[slot] < jobPlacement.load[best]) {
+      best = slot;
+    }
+  }
+  jobPlacement.next = best + 1;
+  return best;
+}
+
+
+/*******************************************************************************
+ *          void placementEnter(int slot), void placementLeave(int slot)
+ * Description: moves the shell onto a slot's CPUs and memory policy before
+ *   it starts a job's processes, and back to its own afterwards. The memory
+ *   policy is MPOL_PREFERRED, so a job whose node is full still gets memory
+ *   from the others. It is left out where the kernel has no NUMA support.
+*******************************************************************************/
+void placementEnter(int slot) {
+  sched_setaffinity(0, sizeof(cpu_set_t), &jobPlacement.cpus[slot]);
+  if(jobPlacement.nodes[slot] >= 0) {
+    unsigned long nodeMask[CPU_SETSIZE / (8 * sizeof(unsigned long))] = {0};
+    int node = jobPlacement.nodes[slot];
+    nodeMask[node / (8 * sizeof(unsigned long))] |=
+      1UL << (node % (8 * sizeof(unsigned long)));
+    syscall(SYS_set_mempolicy, MPOL_PREFERRED, nodeMask, CPU_SETSIZE);
+  }
+}
+
+void placementLeave(int slot) {
+  sched_setaffinity(0, sizeof(cpu_set_t), &jobPlacement.shellCpus);
+  if(jobPlacement.nodes[slot] >= 0) {
+    syscall(SYS_set_mempolicy, MPOL_DEFAULT, NULL, 0);
+  }
+}
+
+
+/*******************************************************************************
+ *                    void placementRelease(int slot)
+ * Description: takes a background process that has finished off its slot
+*******************************************************************************/
+void placementRelease(int slot) {
+  if(slot >= 0 && slot < jobPlacement.numSlots) {
+    jobPlacement.load[slot] -= 1;
+  }
+}
+
+
+/*******************************************************************************
+ *                              job limits
+ * A command prefixed with "limit" has its resources capped. When
+ * SMALLSH_CGROUP names a cgroup v2 directory the shell may create cgroups in,
+ * each limited job gets a leaf cgroup of its own there, smallsh-<pid>-<n>,
+ * whose memory.max, cpu.max and pids.max hold the mem, cores and procs
+ * limits, so they cover the whole job. Otherwise, or if the leaf cannot be
+ * set up, mem and procs are set per process as RLIMIT_AS and RLIMIT_NPROC
+ * (which counts every process of the user) and cores is not applied, which
+ * the shell warns about. cpu and files are always RLIMIT_CPU and
+ * RLIMIT_NOFILE. Everything is applied in the
+ * child between fork() and exec(), so a limited command is always started
+ * with fork() and never runs uncapped.
+*******************************************************************************/
+
+
+/*******************************************************************************
+ *          int writeCgroupFile(int directory, char* file, char* value)
+ * Description: writes value to one of the files of the cgroup directory
+ * Output: FALSE if it could not be written
+*******************************************************************************/
+int writeCgroupFile(int directory, char* file, char* value) {
+  int fd = openat(directory, file, O_WRONLY | O_CLOEXEC);
+  if(fd == -1) {
+    return FALSE;
+  }
+  ssize_t written = write(fd, value, strlen(value));
+  close(fd);
+  return written == (ssize_t)strlen(value);
+}
+
+
+/*******************************************************************************
+ *          char* createJobCgroup(jobLimits* limits, int* procsFile)
+ * Description: creates the leaf cgroup of a limited job in cgroupRoot and
+ *   writes its limits. Before the first one, the memory, cpu and pids
+ *   controllers are enabled for cgroupRoot's children, as far as they can be.
+ *   The leaf's cgroup.procs is opened for the job's processes to join.
+ * Output: the path of the leaf, which the caller frees, with *procsFile set.
+ *   NULL if it could not be set up, in which case the rlimits are used.
+*******************************************************************************/
+char* createJobCgroup(jobLimits* limits, int* procsFile) {
+  char value[48];
+  *procsFile = -1;
+  if(cgroupJobs == 0) {
+    int root = open(cgroupRoot, O_DIRECTORY | O_CLOEXEC);
+    if(root != -1) {
+      writeCgroupFile(root, "cgroup.subtree_control", "+memory");
+      writeCgroupFile(root, "cgroup.subtree_control", "+cpu");
+      writeCgroupFile(root, "cgroup.subtree_control", "+pids");
+      close(root);
+    }
+  }
+  cgroupJobs += 1;
+
+  char* path = malloc(strlen(cgroupRoot) + 48);
+  assert(path != NULL);
+  sprintf(path, "%s/smallsh-%d-%d", cgroupRoot, (int)getpid(), cgroupJobs);
+  int ok = mkdir(path, 0755) == 0;
+  int directory = ok ? open(path, O_DIRECTORY | O_CLOEXEC) : -1;
+  ok = directory != -1;
+
+  if(ok && limits->memory > 0) {
+    sprintf(value, "%ld", limits->memory);
+    ok = writeCgroupFile(directory, "memory.max", value);
+    /* without this the job could go on in swap */
+    writeCgroupFile(directory, "memory.swap.max", "0");
+  }
+  if(ok && limits->cores > 0) {
+    sprintf(value, "%ld 100000", limits->cores);
+    ok = writeCgroupFile(directory, "cpu.max", value);
+  }
+  if(ok && limits->procs > 0) {
+    sprintf(value, "%ld", limits->procs);
+    ok = writeCgroupFile(directory, "pids.max", value);
+  }
+  if(ok) {
+    *procsFile = openat(directory, "cgroup.procs", O_WRONLY | O_CLOEXEC);
+    ok = *procsFile != -1;
+  }
+  int error = errno;
+  if(directory != -1) {
+    close(directory);
+  }
+
+  if(!ok) {
+    fflush(stdout);
+    fprintf(stderr, "limit: %s: %s, using rlimits instead\n", path,
+            strerror(error));
+    rmdir(path);
+    free(path);
+    return NULL;
+  }
+  return path;
+}
+
+
+/*******************************************************************************
+ *        void lowerLimit(int resource, rlim_t soft, rlim_t hard)
+ * Description: sets an rlimit of the calling process to soft and hard, each
+ *   no higher than the current hard limit, which cannot be raised
+*******************************************************************************/
+void lowerLimit(int resource, rlim_t soft, rlim_t hard) {
+  struct rlimit limit;
+  if(getrlimit(resource, &limit) == 0 && limit.rlim_max != RLIM_INFINITY) {
+    soft = soft < limit.rlim_max ? soft : limit.rlim_max;
+    hard = hard < limit.rlim_max ? hard : limit.rlim_max;
+  }
+  limit.rlim_cur = soft;
+  limit.rlim_max = hard;
+  setrlimit(resource, &limit);
+}
+
+
+/*******************************************************************************
+ *            void applyLimits(jobLimits* limits, int procsFile)
+ * Description: caps the resources of a child that is about to exec. With a
+ *   cgroup the child first moves itself into it through procsFile. The caps
+ *   are only ever lowered: a cap above the current hard limit is left at the
+ *   hard limit. The hard CPU limit is one second past the soft one, so that a
+ *   command that uses up its CPU time is ended by SIGXCPU.
+*******************************************************************************/
+void applyLimits(jobLimits* limits, int procsFile) {
+  if(procsFile != -1) {
+    char pid[24];
+    sprintf(pid, "%d", (int)getpid());
+    if(write(procsFile, pid, strlen(pid)) == -1) {
+      perror("limit: cannot join the job's cgroup");
+      exit(1);
+    }
+  }
+  if(limits->cpuSeconds > 0) {
+    lowerLimit(RLIMIT_CPU, limits->cpuSeconds, limits->cpuSeconds + 1);
+  }
+  if(limits->files > 0) {
+    lowerLimit(RLIMIT_NOFILE, limits->files, limits->files);
+  }
+  if(procsFile == -1 && limits->memory > 0) {
+    lowerLimit(RLIMIT_AS, limits->memory, limits->memory);
+  }
+  if(procsFile == -1 && limits->procs > 0) {
+    lowerLimit(RLIMIT_NPROC, limits->procs, limits->procs);
+  }
+}
+
+
+/*******************************************************************************
+ *               char* limitReason(char* cgroup, int results)
+ * Description: explains a process ending because of its job's limits: a
+ *   process ended by SIGXCPU ran out of CPU time, and one killed while its
+ *   job's cgroup had an out of memory kill ran out of memory
+ * Output: " (cpu limit)", " (memory limit)" or ""
+*******************************************************************************/
+char* limitReason(char* cgroup, int results) {
+  char events[512];
+  if(!WIFSIGNALED(results)) {
+    return "";
+  }
+  if(WTERMSIG(results) == SIGXCPU) {
+    return " (cpu limit)";
+  }
+  if(cgroup == NULL || WTERMSIG(results) != SIGKILL) {
+    return "";
+  }
+
+  int directory = open(cgroup, O_DIRECTORY | O_CLOEXEC);
+  int fd = directory == -1 ? -1 :
+           openat(directory, "memory.events", O_RDONLY | O_CLOEXEC);
+  ssize_t length = fd == -1 ? -1 : read(fd, events, sizeof(events) - 1);
+  if(fd != -1) {
+    close(fd);
+  }
+  if(directory != -1) {
+    close(directory);
+  }
+  if(length <= 0) {
+    return "";
+  }
+  events[length] = '\0';
+  char* kills = strstr(events, "oom_kill ");
+  return kills != NULL && atol(kills + 9) > 0 ? " (memory limit)" : "";
+}
+
+
+/*******************************************************************************
+ *   int forkChild(args, int inputFile, int outputFile, int errorFile, pgid)
+ * Description: launches the command with fork(). The child moves the given
+ *   descriptors onto stdin/stdout/stderr (-1 leaves them alone and
+ *   ERROR_TO_OUTPUT points stderr at the new stdout), joins the process
+ *   group pgid (0 starts a new one, -1 stays in the shell's) and then calls 
+ *   exec(), calling the new process. The location found by resolveCommand is
+ *   executed directly. If it has disappeared since it was remembered the child
+ *   falls back to searching PATH itself. A limited command's limits are
+ *   applied just before the exec (see applyLimits).
+ * Input: list of arguments, descriptors for stdin/stdout/stderr, process
+ *   group, and the job's limits (NULL for none) and cgroup.procs (or -1)
+ * Output: the pid of the child, or -1 if fork() failed
+*******************************************************************************/
+int forkChild(char** args, int inputFile, int outputFile, int errorFile,
+              int pgid, jobLimits* limits, int procsFile) {
+  char* path = resolveCommand(args[0]);
+
+  /* create a copy of the current process */
+  int pid = fork();
+
+  switch (pid) {
+    /* pid is -1, error */
+    case -1:
+      perror("fork() failed.\n");
+      break;
+
+    /* pid is 0, child process */
+    case 0:
+      /* set the child process to ignore SIGTSTP interrupts, and undo the
+         shell's blocking of signals */
+      signal(SIGTSTP, SIG_IGN);
+      sigprocmask(SIG_SETMASK, &childSignalMask, NULL);
+      if(pgid != -1) {
+        setpgid(0, pgid);
+      }
+      if(limits != NULL) {
+        applyLimits(limits, procsFile);
+      }
+
+      /* set file redirection. the originals are closed by exec */
+      if(inputFile != -1) {
+        dup2(inputFile, 0);
+      }
+      if(outputFile != -1) {
+        dup2(outputFile, 1);
+      }
+      if(errorFile != -1) {
+        dup2(errorFile == ERROR_TO_OUTPUT ? 1 : errorFile, 2);
+      }
+
+      /* call exec to execute other program, preserving file redirection */
+      if(path != NULL) {
+        execv(path, args);
+      }
+      if(path == NULL || errno == ENOENT) {
+        execvp(args[0], args);
+      }
+      printExecError(args[0], errno);
+      exit(1);
+
+    /* pid is a valid pid of the child process */
+    /* this is the parent */
+    default:
+      /* set the group from this side as well so it exists before fork
+         returns, whichever process runs first */
+      if(pgid != -1) {
+        setpgid(pid, pgid == 0 ? pid : pgid);
+      }
+      break;
+  };
+
+  return pid;
+}
+
+
+/*******************************************************************************
+ * int posixSpawnChild(args, int inputFile, int outputFile, int errorFile, pgid)
+ * Description: launches the command with posix_spawn(), which starts the child
+ *   without duplicating the shell's page tables. The descriptors are handed to
+ *   the child as dup2 file actions (-1 leaves stdin/stdout/stderr alone, and
+ *   ERROR_TO_OUTPUT duplicates the new stdout onto stderr) and it is
+ *   placed in process group pgid (0 starts a new one, -1 stays in the shell's).
+ *   The child inherits the shell's ignored SIGTSTP and is given the signal
+ *   mask the shell was started with.
+ *   The command is executed from the location found by resolveCommand. If it
+ *   no longer exists there its cache entry is dropped and PATH searched again.
+ * Input: list of arguments, descriptors for stdin/stdout/stderr, process group
+ * Output: the pid of the child, or -1 if it could not be started
+*******************************************************************************/
+int posixSpawnChild(char** args, int inputFile, int outputFile, int errorFile,
+                    int pgid) {
+  int pid = -1;
+
+  /* dup2 in the child clears O_CLOEXEC on 0, 1 and 2, the originals are
+     closed by exec. the actions run in order, so 2>&1 copies the new stdout */
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  if(inputFile != -1) {
+    posix_spawn_file_actions_adddup2(&actions, inputFile, 0);
+  }
+  if(outputFile != -1) {
+    posix_spawn_file_actions_adddup2(&actions, outputFile, 1);
+  }
+  if(errorFile != -1) {
+    posix_spawn_file_actions_adddup2(&actions,
+                                     errorFile == ERROR_TO_OUTPUT ? 1 :
+                                     errorFile, 2);
+  }
+
+  posix_spawnattr_t attributes;
+  short flags = POSIX_SPAWN_SETSIGMASK;
+  posix_spawnattr_init(&attributes);
+  posix_spawnattr_setsigmask(&attributes, &childSignalMask);
+  if(pgid != -1) {
+    posix_spawnattr_setpgroup(&attributes, pgid);
+    flags |= POSIX_SPAWN_SETPGROUP;
+  }
+  posix_spawnattr_setflags(&attributes, flags);
+
+  int error = ENOENT;
+  char* path = resolveCommand(args[0]);
+  if(path != NULL) {
+    error = posix_spawn(&pid, path, &actions, &attributes, args, environ);
+    if(error == ENOENT && path != args[0]) {
+      pathCacheRemove(args[0]);
+      path = resolveCommand(args[0]);
+      if(path != NULL) {
+        error = posix_spawn(&pid, path, &actions, &attributes, args, environ);
+      }
+    }
+  }
+
+  posix_spawnattr_destroy(&attributes);
+  posix_spawn_file_actions_destroy(&actions);
+
+  if(error != 0) {
+    printExecError(args[0], error);
+    return -1;
+  }
+  return pid;
+}
+
+
+/*******************************************************************************
+ *  int launchChild(args, inputFile, outputFile, errorFile, pgid, limits,
+ *                  procsFile)
+ * Description: launches one process using the current spawn mode, or with
+ *   fork() when it has limits to apply. Anything the shell has buffered is
+ *   written first, so that it comes out before the child's output (and is
+ *   not copied into a forked child).
+*******************************************************************************/
+int launchChild(char** args, int inputFile, int outputFile, int errorFile,
+                int pgid, jobLimits* limits, int procsFile) {
+  fflush(stdout);
+  if(spawnMode == SPAWN_FORK || limits != NULL) {
+    return forkChild(args, inputFile, outputFile, errorFile, pgid, limits,
+                     procsFile);
+  }
+  return posixSpawnChild(args, inputFile, outputFile, errorFile, pgid);
+}
+
+
+/*******************************************************************************
+ *  void traceSpawn(command* cmd, int stage, int pid, struct timespec* began)
+ * Description: records the launch of one stage of a command with its command
+ *   name, pid, whether it is a background command and the files it was
+ *   redirected to. With posix_spawn the fork and the exec are a single call,
+ *   so the event covers both.
+*******************************************************************************/
+void traceSpawn(command* cmd, int stage, int pid, struct timespec* began) {
+  char** args = cmd->args + cmd->stageStart[stage];
+  char value[24];
+  if(traceFd == -1) {
+    return;
+  }
+  traceBegin(spawnMode == SPAWN_FORK ? "fork" : "posix_spawn", getpid(), began,
+             NULL);
+  traceArgument("command", args[0], TRUE);
+  sprintf(value, "%d", pid);
+  traceArgument("pid", value, FALSE);
+  traceArgument("background", cmd->backgroundFlag ? "true" : "false", FALSE);
+  if(stage == 0 && cmd->inputRedirectionFlag) {
+    traceArgument("stdin", cmd->inputRedirectionFileName, FALSE);
+  }
+  if(stage == cmd->numStages - 1 && cmd->outputRedirectionFlag) {
+    traceArgument("stdout", cmd->outputRedirectionFileName, FALSE);
+  }
+  if(cmd->errorRedirectionFlag) {
+    traceArgument("stderr", cmd->errorRedirectionFileName, FALSE);
+  }
+  else if(cmd->errorToOutputFlag) {
+    traceArgument("stderr", "stdout", FALSE);
+  }
+  traceEnd();
+
+  /* name the child's track after its command */
+  if(pid != -1) {
+    tracePrintf(",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, "
+                "\"tid\": %d, \"args\": {\"name\": ", getpid(), pid);
+    traceString(args[0]);
+    tracePrintf("}}");
+  }
+}
+
+
+/*******************************************************************************
+ *                    int isCacheable(char* line)
+ * Description: decides whether the parse of a line is the same every time,
+ *   which is when every '$' in it is part of a $$
+*******************************************************************************/
+int isCacheable(char* line) {
+  while(*line != '\0') {
+    if(line[0] == '$') {
+      if(line[1] != '$') {
+        return FALSE;
+      }
+      line += 2;
+    }
+    else {
+      line += 1;
+    }
+  }
+  return TRUE;
+}
+
+
+/*******************************************************************************
+ *                          struct ParsedAhead
+ * When the whole of the input is already in memory (a mapped script or a -c
+ * command) the shell does not sit idle while a foreground command runs: it
+ * reads the lines that follow and parses each into its own command, so the
+ * next command is ready to launch as soon as the current one is done. The
+ * lines wait in this ring until the prompt hands them out, aheadHead counting
+ * the lines read and aheadTail the lines handed out. The slot handed out last
+ * may still be running, so it is not refilled until the one after it is
+ * handed out.
+ * Only a line whose parse cannot change before it runs is parsed ahead: one
+ * that isCacheable and is not a history expansion. Any other line is kept as
+ * it was read and parsed when its turn comes.
+*******************************************************************************/
+typedef struct ParsedAhead {
+  char* line;
+  command parsed;
+  int isParsed;
+} parsedAhead;
+
+parsedAhead aheadRing[LOOKAHEAD_SIZE];
+unsigned aheadHead = 0;
+unsigned aheadTail = 0;
+
+
+/*******************************************************************************
+ *             int parseAhead(result* status, processes* procs)
+ * Description: reads the next line of the input into the ring, parsing it if
+ *   that is safe
+ * Output: TRUE if a line was read, FALSE if there was nothing to do
+*******************************************************************************/
+int parseAhead(result* status, processes* procs) {
+  if(!input.eof || aheadHead - aheadTail >= LOOKAHEAD_SIZE - 1) {
+    return FALSE;
+  }
+  char* line = readerNextLine(&input);
+  if(line == NULL) {
+    return FALSE;
+  }
+
+  parsedAhead* slot = &aheadRing[aheadHead % LOOKAHEAD_SIZE];
+  aheadHead += 1;
+  slot->line = line;
+  slot->isParsed = FALSE;
+  if(isCacheable(line) && line[strspn(line, " \t")] != '!') {
+    struct timespec traceBegan;
+    traceClock(&traceBegan);
+    if(slot->parsed.args == NULL) {
+      initializeCommand(&slot->parsed, INITIAL_NUMBER_ARGS);
+    }
+    parseLine(line, &slot->parsed, status, procs);
+    slot->isParsed = TRUE;
+    traceEvent("parse ahead", &traceBegan);
+  }
+  return TRUE;
+}
+
+
+/*******************************************************************************
+ *                  char* nextAheadLine(command** parsed)
+ * Description: hands out the oldest line that was read ahead
+ * Output: the line, or NULL if none are waiting. *parsed is set to its
+ *   command if it was parsed, or NULL.
+*******************************************************************************/
+char* nextAheadLine(command** parsed) {
+  *parsed = NULL;
+  if(aheadTail == aheadHead) {
+    return NULL;
+  }
+  parsedAhead* slot = &aheadRing[aheadTail % LOOKAHEAD_SIZE];
+  aheadTail += 1;
+  if(slot->isParsed) {
+    *parsed = &slot->parsed;
+  }
+  return slot->line;
+}
+
+
+/*******************************************************************************
+ *                      void destroyParsedAhead()
+ * Description: frees the commands of the read ahead ring
+*******************************************************************************/
+void destroyParsedAhead() {
+  int i;
+  for(i = 0; i < LOOKAHEAD_SIZE; ++i) {
+    if(aheadRing[i].parsed.args != NULL) {
+      destroyCommand(&aheadRing[i].parsed);
+    }
+  }
+  aheadHead = 0;
+  aheadTail = 0;
+}
+
+
+/*******************************************************************************
+ *                    char* commandText(command* cmd)
+ * Description: joins the words of a command back into a line, with the
+ *   stages separated by " | ", to name the job it runs as
+ * Output: the line, which the caller frees
+*******************************************************************************/
+char* commandText(command* cmd) {
+  size_t length = 1;
+  char** arg;
+  int stage;
+  for(stage = 0; stage < cmd->numStages; ++stage) {
+    for(arg = cmd->args + cmd->stageStart[stage]; *arg != NULL; ++arg) {
+      length += strlen(*arg) + 3;
+    }
+  }
+
+  char* text = malloc(length);
+  assert(text != NULL);
+  char* end = text;
+  *end = '\0';
+  for(stage = 0; stage < cmd->numStages; ++stage) {
+    for(arg = cmd->args + cmd->stageStart[stage]; *arg != NULL; ++arg) {
+      if(end != text) {
+        end = stpcpy(end, arg == cmd->args + cmd->stageStart[stage] ?
+                          " | " : " ");
+      }
+      end = stpcpy(end, *arg);
+    }
+  }
+  return text;
+}
+
+
+/*******************************************************************************
+ *                   int printJob(processes* procs, int index)
+ * Description: prints the job whose first process is in slot index as
+ *   "[number] pgid Running|Stopped name". A job is stopped when any of its
+ *   processes is.
+ * Output: the slot of the first process of the next job, or -1
+*******************************************************************************/
+int printJob(processes* procs, int index) {
+  job* first = &procs->jobs[index];
+  int stopped = FALSE;
+  int i;
+  for(i = index; i != -1 && procs->jobs[i].number == first->number;
+      i = procs->jobs[i].next) {
+    stopped |= procs->jobs[i].stopped;
+  }
+  printf("[%d] %d %s %s\n", first->number, first->pgid,
+         stopped ? "Stopped" : "Running", first->name);
+  return i;
+}
+
+
+/*******************************************************************************
+ *      void setForegroundStatus(result* status, int results, char* cgroup)
+ * Description: saves the wait status of the last process of a foreground
+ *   job as the status of the last foreground command, reporting a signal
+ *   that terminated it (and whether the limits of the job's cgroup did). A
+ *   job the terminal interrupted counts as a SIGINT to the shell, which
+ *   never sees that one itself, so that it stops any block that is running.
+*******************************************************************************/
+void setForegroundStatus(result* status, int results, char* cgroup) {
+  if(WIFEXITED(results) != 0) {
+    status->sig = FALSE;
+    status->code = WEXITSTATUS(results);
+  }
+  else if(WIFSIGNALED(results) != 0) {
+    status->sig = TRUE;
+    status->code = WTERMSIG(results);
+    printf("terminated by signal %d%s\n", status->code,
+           limitReason(cgroup, results));
+    flushOutput();
+    if(status->code == SIGINT) {
+      interruptReceived = TRUE;
+    }
+  }
+}
+
+
+/*******************************************************************************
+ *  int waitForeground(processes* procs, result* status, int pgid,
+ *                     int ownsTerminal)
+ * Description: runs the event loop until every foreground child has been
+ *   reaped or one of them has been stopped. Signals are still handled
+ *   meanwhile but their messages wait for the next prompt, except SIGINT,
+ *   which catchSIGINT passes on to the job's process group pgid. The loop
+ *   only blocks once there is nothing left to parse ahead. If the job was 
+ *   given the terminal, the shell takes it back afterwards.
+ * Output: TRUE if the job finished, FALSE if it was stopped
+*******************************************************************************/
+int waitForeground(processes* procs, result* status, int pgid,
+                   int ownsTerminal) {
+  foregroundProcessRunning = TRUE;
+  foregroundPgid = pgid;
+  foregroundOwnsTerminal = ownsTerminal;
+  foregroundStopped = 0;
+  while(foregroundRemaining > 0 && foregroundStopped == 0) {
+    handleEvents(parseAhead(status, procs) ? 0 : -1);
+  }
+  foregroundProcessRunning = FALSE;
+  foregroundPgid = 0;
+  foregroundOwnsTerminal = FALSE;
+  if(ownsTerminal) {
+    tcsetpgrp(STDIN_FILENO, getpgrp());
+  }
+  return foregroundStopped == 0;
+}
+
+
+/*******************************************************************************
+ *  void stopForeground(processes* procs, result* status, int number,
+ *                      int pgid, char* name, char* cgroup)
+ * Description: turns the foreground job, which has been stopped, into a
+ *   stopped job the jobs built-ins can continue. Its processes that have not
+ *   finished are added to procs under job number (or a new one when number
+ *   is 0), with its name and cgroup (or NULL), and the job is printed. The
+ *   status of the last foreground command is 128 plus the stop signal.
+*******************************************************************************/
+void stopForeground(processes* procs, result* status, int number, int pgid,
+                    char* name, char* cgroup) {
+  int first = -1;
+  int i;
+  if(number == 0) {
+    number = processesNewJob(procs);
+  }
+  for(i = 0; i < numForegroundPids; ++i) {
+    int pid = foregroundPids[i];
+    if(pid == 0) {
+      continue;
+    }
+    processesAdd(procs, pid);
+    int index = processesFind(procs, pid);
+    job* stoppedJob = &procs->jobs[index];
+    stoppedJob->number = number;
+    stoppedJob->pgid = pgid;
+    stoppedJob->name = strdup(name);
+    stoppedJob->cgroup = cgroup == NULL ? NULL : strdup(cgroup);
+    stoppedJob->started = foregroundStarted;
+    processesSetStopped(procs, index, foregroundStopped);
+    if(first == -1) {
+      first = index;
+    }
+  }
+  numForegroundPids = 0;
+  foregroundRemaining = 0;
+
+  status->sig = FALSE;
+  status->code = 128 + foregroundStopped;
+  if(first != -1) {
+    printJob(procs, first);
+    flushOutput();
+  }
+}
+
+
+/*******************************************************************************
+ *     void launchCommand(command* cmd, processes* procs, result* status)
+ * Description: launches the command in new processes using the current spawn
+ *   mode, then either records them as background processes or waits for them
+ *   to finish and saves the exit status. While it waits, the lines after it
+ *   are read and parsed ahead.
+ *   Each stage of a pipeline gets its own process. Neighbouring stages are
+ *   connected with a pipe2(O_CLOEXEC) pipe. Every command runs as a job in a
+ *   process group of its own, led by the first stage. Background jobs are
+ *   numbered, placed as the placement policy says and captured if capturing
+ *   is on (the last stage writes into the job's stream), and a foreground job
+ *   is given the terminal while it runs and becomes a stopped job if it is
+ *   stopped. Its exit status is that of the last stage. The start time is
+ *   kept so that a timed command can report how long it ran.
+ * Input: the parsed command
+ * Output: none
+*******************************************************************************/
+void launchCommand(command* cmd, processes* procs, result* status) {
+  assert(cmd != NULL && cmd->args != NULL);
+  int inputFile;
+  int outputFile;
+  int errorFile;
+
+  if(!openRedirections(cmd, &inputFile, &outputFile, &errorFile)) {
+    /* the command never ran. a foreground command fails with exit value 1 
+       just as if the child had reported the error itself */
+    if(!cmd->backgroundFlag) {
+      status->sig = FALSE;
+      status->code = 1;
+    }
+    return;
+  }
+
+  int pgid = 0;
+  int ownsTerminal = FALSE;
+  int number = cmd->backgroundFlag ? processesNewJob(procs) : 0;
+  char* name = cmd->backgroundFlag ? commandText(cmd) : NULL;
+  jobLimits* limits = cmd->limits.set ? &cmd->limits : NULL;
+  char* cgroup = NULL;
+  int procsFile = -1;
+  if(limits != NULL && cgroupRoot != NULL) {
+    cgroup = createJobCgroup(limits, &procsFile);
+  }
+  if(limits != NULL && limits->cores > 0 && cgroup == NULL) {
+    fflush(stdout);
+    fprintf(stderr, "limit: cores needs a cgroup (see SMALLSH_CGROUP), "
+            "running without it\n");
+  }
+  int captured = FALSE;
+  if(cmd->backgroundFlag && !cmd->outputRedirectionFlag) {
+    int captureFile = captureStart(number);
+    if(captureFile != -1) {
+      outputFile = captureFile;
+      captured = TRUE;
+    }
+  }
+  int place = cmd->backgroundFlag ? placementChoose() : -1;
+  if(place != -1) {
+    placementEnter(place);
+  }
+  int stageInput = inputFile;
+  int pid = -1;
+  int stage;
+  int timed = cmd->timeFlag || timingAll;
+  struct timespec started;
+  numForegroundPids = 0;
+  foregroundRemaining = 0;
+  memset(&foregroundUsage, 0, sizeof(struct rusage));
+  clock_gettime(CLOCK_MONOTONIC, &started);
+  foregroundEnded = started;
+  foregroundStarted = started;
+
+  for(stage = 0; stage < cmd->numStages; ++stage) {
+    char** args = cmd->args + cmd->stageStart[stage];
+    int stageOutput = outputFile;
+    int nextInput = -1;
+
+    /* connect this stage to the next with a pipe */
+    if(stage < cmd->numStages - 1) {
+      int pipeFiles[2];
+      if(pipe2(pipeFiles, O_CLOEXEC) == -1) {
+        perror("pipe2() failed");
+        break;
+      }
+      if(pipeSize > 0) {
+        fcntl(pipeFiles[1], F_SETPIPE_SZ, pipeSize);
+      }
+      nextInput = pipeFiles[0];
+      stageOutput = pipeFiles[1];
+    }
+
+    STATS_BEGIN(spawnBegan);
+    struct timespec traceBegan;
+    traceClock(&traceBegan);
+    pid = launchChild(args, stageInput, stageOutput, errorFile, pgid, limits,
+                      procsFile);
+    STATS_END(STAT_SPAWN, spawnBegan);
+    traceSpawn(cmd, stage, pid, &traceBegan);
+
+    /* the shell's copies of the pipe ends are no longer needed */
+    if(stage > 0) {
+      close(stageInput);
+    }
+    if(stage < cmd->numStages - 1) {
+      close(stageOutput);
+    }
+    stageInput = nextInput;
+
+    if(pid == -1) {
+      continue;
+    }
+
+    /* the first stage that actually started leads the job's process group:
+       pgid stays 0 past a stage that could not be started, so the next one
+       starts the group and every later stage joins it. a foreground job
+       reading from a terminal needs it to be the terminal's foreground group.
+       a stage that read the terminal too early was stopped, so it is
+       continued */
+    if(pgid == 0) {
+      pgid = pid;
+      if(!cmd->backgroundFlag && isatty(STDIN_FILENO) &&
+         tcsetpgrp(STDIN_FILENO, pgid) == 0) {
+        ownsTerminal = TRUE;
+        kill(-pgid, SIGCONT);
+      }
+    }
+
+    /* record the process as a background process, or one to wait for */
+    if(cmd->backgroundFlag) {
+      printf("background pid is %d\n", pid);
+      flushOutput();
+      processesAdd(procs, pid);
+      procs->lastPid = pid;
+      job* newJob = &procs->jobs[processesFind(procs, pid)];
+      newJob->timed = timed;
+      newJob->started = started;
+      newJob->number = number;
+      newJob->pgid = pgid;
+      newJob->name = strdup(name);
+      newJob->cgroup = cgroup == NULL ? NULL : strdup(cgroup);
+      newJob->place = place;
+      if(place != -1) {
+        jobPlacement.load[place] += 1;
+      }
+    }
+    else {
+      foregroundAdd(pid);
+    }
+  }
+
+  if(stageInput != -1 && stage > 0) {
+    close(stageInput);
+  }
+  closeRedirection(inputFile);
+  closeRedirection(outputFile);
+  if(errorFile != ERROR_TO_OUTPUT) {
+    closeRedirection(errorFile);
+  }
+  if(procsFile != -1) {
+    close(procsFile);
+  }
+  if(place != -1) {
+    placementLeave(place);
+  }
+  if(captured) {
+    captureStarted(pgid);
+  }
+
+  if(cmd->backgroundFlag) {
+    free(name);
+    free(cgroup);
+    return;
+  }
+
+  STATS_BEGIN(waitBegan);
+  struct timespec traceBegan;
+  traceClock(&traceBegan);
+  int finished = waitForeground(procs, status, pgid, ownsTerminal);
+  STATS_END(STAT_WAIT, waitBegan);
+  traceEvent("wait", &traceBegan);
+  if(!finished) {
+    name = commandText(cmd);
+    stopForeground(procs, status, 0, pgid, name, cgroup);
+    free(name);
+    free(cgroup);
+    return;
+  }
+  if(timed) {
+    printTimes(&started, &foregroundEnded, &foregroundUsage);
+    printf("\n");
+    flushOutput();
+  }
+
+  /* the last stage could not be started */
+  if(pid == -1) {
+    status->sig = FALSE;
+    status->code = 1;
+  }
+  /* get the status of the terminated process */
+  else {
+    setForegroundStatus(status, foregroundResults, cgroup);
+  }
+  /* the job's cgroup is empty once all of it has been reaped */
+  if(cgroup != NULL) {
+    rmdir(cgroup);
+    free(cgroup);
+  }
+}
+  
+
+/*******************************************************************************
+ *                        struct QueuedCommand
+ * A background command that is waiting for a free slot under jobs-limit.
+ * Queued commands form a first-in first-out list.
+*******************************************************************************/
+typedef struct QueuedCommand {
+  command parsed;
+  struct QueuedCommand* next;
+} queuedCommand;
+
+queuedCommand* queueHead = NULL;
+queuedCommand* queueTail = NULL;
+int queueLength = 0;
+
+
+/*******************************************************************************
+ *                  void queueCommand(command* cmd)
+ * Description: copies the parsed command, with its stages and redirections,
+ *   onto the end of the queue
+*******************************************************************************/
+void queueCommand(command* cmd) {
+  queuedCommand* queued = malloc(sizeof(queuedCommand));
+  assert(queued != NULL);
+  initializeCommand(&queued->parsed, cmd->numArgs + 1);
+  copyCommand(cmd, &queued->parsed);
+
+  queued->next = NULL;
+  if(queueTail != NULL) {
+    queueTail->next = queued;
+  }
+  else {
+    queueHead = queued;
+  }
+  queueTail = queued;
+  queueLength += 1;
+}
+
+
+/*******************************************************************************
+ *                  void startQueuedJobs(processes* procs)
+ * Description: launches queued background commands, oldest first, while there
+ *   are fewer jobs running than jobs-limit allows
+*******************************************************************************/
+void startQueuedJobs(processes* procs) {
+  result unused;
+
+  while(queueHead != NULL &&
+        (jobsLimit == 0 || processesRunningJobs(procs) < jobsLimit)) {
+    queuedCommand* queued = queueHead;
+    queueHead = queued->next;
+    if(queueHead == NULL) {
+      queueTail = NULL;
+    }
+    queueLength -= 1;
+
+    /* it was queued as a background command, so it stays one */
+    queued->parsed.backgroundFlag = TRUE;
+    launchCommand(&queued->parsed, procs, &unused);
+
+    destroyCommand(&queued->parsed);
+    free(queued);
+  }
+}
+
+
+/*******************************************************************************
+ *      void spawnProcess(command* cmd, processes* procs, result* status)
+ * Description: runs a command in new processes. A background command that
+ *   would take the number of running jobs past jobs-limit is queued instead,
+ *   and launched by startQueuedJobs once enough of the running ones have
+ *   finished or stopped. A job counts once however many processes its
+ *   pipeline has.
+ * Input: the parsed command
+ * Output: none
+*******************************************************************************/
+void spawnProcess(command* cmd, processes* procs, result* status) {
+  if(cmd->backgroundFlag && jobsLimit > 0 &&
+     (queueHead != NULL || processesRunningJobs(procs) >= jobsLimit)) {
+    queueCommand(cmd);
+    printf("background job queued (%d waiting)\n", queueLength);
+    flushOutput();
+    return;
+  }
+  launchCommand(cmd, procs, status);
+}
+
+
+/*******************************************************************************
+ *                     void jobsLimitCommand(char** args)
+ * Description: the jobs-limit built-in. "jobs-limit N" allows at most N
+ *   jobs to run at once ("cores" means one per online CPU, 0 means no
+ *   limit). Without an argument the current limit is printed.
+*******************************************************************************/
+void jobsLimitCommand(char** args, processes* procs, result* status) {
+  if(args[1] == NULL) {
+    if(jobsLimit == 0) {
+      printf("jobs-limit: none\n");
+    }
+    else {
+      printf("jobs-limit: %d (%d running, %d waiting)\n", jobsLimit,
+             processesRunningJobs(procs), queueLength);
+    }
+    flushOutput();
+    return;
+  }
+
+  if(strcmp(args[1], "cores") == 0) {
+    jobsLimit = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  else {
+    char* end;
+    long limit = strtol(args[1], &end, 10);
+    if(*end != '\0' || limit < 0) {
+      printf("jobs-limit: %s: not a number\n", args[1]);
+      flushOutput();
+      return;
+    }
+    jobsLimit = (int)limit;
+  }
+
+  /* a raised limit may let queued commands start */
+  startQueuedJobs(procs);
+}
+
+
+/*******************************************************************************
+ *                       void placeCommand(char** args)
+ * Description: the place built-in. "place cores" and "place nodes" spread
+ *   the background jobs started from now on over the CPUs or the NUMA nodes
+ *   (see struct Placement), and "place none" stops placing them. Without an
+ *   argument the policy is printed, with how many background processes are
+ *   running on each slot.
+*******************************************************************************/
+void placeCommand(char** args, processes* procs, result* status) {
+  char* modes[] = {"none", "cores", "nodes"};
+  int i;
+
+  if(args[1] == NULL) {
+    printf("place: %s\n", modes[jobPlacement.mode]);
+    for(i = 0; i < jobPlacement.numSlots; ++i) {
+      if(jobPlacement.nodes[i] >= 0) {
+        printf("node %d: %d cpus, %d running\n", jobPlacement.nodes[i],
+               CPU_COUNT(&jobPlacement.cpus[i]), jobPlacement.load[i]);
+      }
+      else {
+        printf("slot %d: %d cpus, %d running\n", i,
+               CPU_COUNT(&jobPlacement.cpus[i]), jobPlacement.load[i]);
+      }
+    }
+    flushOutput();
+    return;
+  }
+
+  int mode;
+  for(mode = PLACE_NONE; mode <= PLACE_NODES; ++mode) {
+    if(strcmp(args[1], modes[mode]) == 0) {
+      break;
+    }
+  }
+  if(mode > PLACE_NODES) {
+    printf("place: %s: not one of none, cores or nodes\n", args[1]);
+    flushOutput();
+    return;
+  }
+
+  /* the jobs already running keep their places but no longer count */
+  for(i = procs->first; i != -1; i = procs->jobs[i].next) {
+    procs->jobs[i].place = -1;
+  }
+  if(!placementSet(mode)) {
+    perror("place: sched_getaffinity() failed");
+    placementClear();
+  }
+}
+
+
+/*******************************************************************************
+ *                      void captureCommand(char** args)
+ * Description: the capture built-in. "capture FILE" sends the output of the
+ *   background jobs started from now on, a line at a time, to the end of FILE
+ *   ("-" for the shell's stdout), "capture -j DIR" gives each of them a log
+ *   of its own in DIR (see struct CaptureStream) and "capture off" stops
+ *   capturing. Jobs that are already captured carry on writing where they
+ *   were. A job with > or >> of its own is not captured. Without an argument
+ *   the current setting is printed.
+*******************************************************************************/
+void captureCommand(char** args, processes* procs, result* status) {
+  captureStream* stream;
+  int streams = 0;
+
+  if(args[1] == NULL) {
+    for(stream = jobCapture.streams; stream != NULL; stream = stream->next) {
+      streams += 1;
+    }
+    if(jobCapture.mode == CAPTURE_OFF) {
+      printf("capture: off (%d running)\n", streams);
+    }
+    else {
+      printf("capture: %s%s (%d running)\n",
+             jobCapture.mode == CAPTURE_JOBS ? "-j " : "", jobCapture.target,
+             streams);
+    }
+    flushOutput();
+    return;
+  }
+
+  int mode = CAPTURE_FILE;
+  char* target = args[1];
+  if(strcmp(args[1], "off") == 0) {
+    mode = CAPTURE_OFF;
+  }
+  else if(strcmp(args[1], "-j") == 0) {
+    mode = CAPTURE_JOBS;
+    target = args[2];
+  }
+  if(target == NULL) {
+    printf("capture: -j needs a directory\n");
+    flushOutput();
+    return;
+  }
+
+  /* the scratch pipe and buffer are made when they are first needed */
+  if(mode != CAPTURE_OFF && jobCapture.buffer == NULL) {
+    if(pipe2(jobCapture.scratch, O_CLOEXEC | O_NONBLOCK) == -1) {
+      perror("capture: pipe2() failed");
+      jobCapture.scratch[0] = -1;
+      jobCapture.scratch[1] = -1;
+      return;
+    }
+    fcntl(jobCapture.scratch[1], F_SETPIPE_SZ, CAPTURE_CHUNK);
+    jobCapture.buffer = malloc(CAPTURE_CHUNK);
+    assert(jobCapture.buffer != NULL);
+  }
+
+  /* the new log is opened before the old one is let go, so a mistake leaves
+     the setting as it was */
+  int file = -1;
+  if(mode == CAPTURE_FILE && strcmp(target, "-") == 0) {
+    fflush(stdout);
+    file = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+  }
+  else if(mode == CAPTURE_FILE) {
+    file = open(target, O_WRONLY | O_CREAT | O_CLOEXEC, 0666);
+    if(file != -1) {
+      lseek(file, 0, SEEK_END);
+    }
+  }
+  struct stat directory;
+  if((mode == CAPTURE_FILE && file == -1) ||
+     (mode == CAPTURE_JOBS && mkdir(target, 0777) == -1 &&
+      (stat(target, &directory) == -1 || !S_ISDIR(directory.st_mode)))) {
+    printf("capture: cannot open %s\n", target);
+    flushOutput();
+    return;
+  }
+
+  if(jobCapture.file != -1) {
+    close(jobCapture.file);
+  }
+  free(jobCapture.target);
+  jobCapture.mode = mode;
+  jobCapture.file = file;
+  jobCapture.target = mode == CAPTURE_OFF ? NULL : strdup(target);
+}
+
+
+/*******************************************************************************
+ *                          void cleanupProcs(procs)
+ * Drains the completion ring filled by reapChildren. For each
+ * background process that has completed or been stopped, a message is printed
+ * to stdout. Only the processes that actually changed are looked at. Queued
+ * background commands are then started in the room they left.
+ * Input:
+ *   processes* pointer to processes struct
+ * Output:
+ *   return: none
+ *   processes struct is modified as processes terminate
+ *   messages are printed to the screen
+*******************************************************************************/
+void cleanupProcs(processes* procs) {
+  STATS_BEGIN(began);
+  completion* entry;
+  int results;
+  int pid;
+  int index;
+  int signal;
+  int code;
+
+  while(completionTail != completionHead || completionOverflow) {
+    /* if reaping ran out of room, reap the rest now that there is some */
+    if(completionTail == completionHead) {
+      completionOverflow = FALSE;
+      reapChildren();
+      continue;
+    }
+
+    entry = &completionRing[completionTail % COMPLETION_RING_SIZE];
+    pid = entry->pid;
+    results = entry->results;
+    completionTail += 1;
+
+    /* ignore any child that is not a tracked background process */
+    index = processesFind(procs, pid);
+    if(index == -1) {
+      continue;
+    }
+
+    /* a process that was stopped or continued is still part of its job */
+    if(WIFSTOPPED(results)) {
+      processesSetStopped(procs, index, WSTOPSIG(results));
+      printf("background pid %d is stopped: signal %d\n", pid,
+             WSTOPSIG(results));
+      flushOutput();
+      continue;
+    }
+    if(WIFCONTINUED(results)) {
+      processesSetStopped(procs, index, 0);
+      continue;
+    }
+
+    /* get the exit status */
+    if (WIFEXITED(results) != 0) {
+      signal = FALSE;
+      code = WEXITSTATUS(results);
+    }
+    else {
+      signal = TRUE;
+      code = WTERMSIG(results);
+    }
+
+    /* and display the results */
+    printf("background pid %d is done: ", pid);
+    if(signal) {
+      printf("terminated by signal %d%s", code,
+             limitReason(procs->jobs[index].cgroup, results));
+    }
+    else {
+      printf("exit value %d", code);
+    }
+    traceChild(pid, TRUE, &procs->jobs[index].started, &entry->reaped,
+               results);
+    if(procs->jobs[index].timed) {
+      printf(" (");
+      printTimes(&procs->jobs[index].started, &entry->reaped, &entry->usage);
+      printf(")");
+    }
+    printf("\n");
+    flushOutput();
+
+    /* remove the process from the processes array. the cgroup of a limited
+       job can be removed once its last process is gone, until then rmdir
+       fails */
+    if(pid == procs->waitPid) {
+      procs->waitResults = results;
+    }
+    if(procs->jobs[index].cgroup != NULL) {
+      rmdir(procs->jobs[index].cgroup);
+    }
+    placementRelease(procs->jobs[index].place);
+    processesRemove(procs, pid);
+  }
+
+  /* finished processes may have made room for queued ones */
+  if(queueHead != NULL) {
+    startQueuedJobs(procs);
+  }
+  STATS_END(STAT_CLEANUP, began);
+}
+
+
+/*******************************************************************************
+ *                  void finishQueuedJobs(processes* procs)
+ * Description: before the shell exits, waits until every queued command has
+ *   been launched so that none of them are silently dropped
+*******************************************************************************/
+void finishQueuedJobs(processes* procs) {
+  while(queueHead != NULL) {
+    fflush(stdout);
+    handleEvents(-1);
+    cleanupProcs(procs);
+  }
+}
+
+
+/*******************************************************************************
+ *            char* prompt(processes* procs, command** parsed)
+ * prints a prompt (when interactive) and gets user input for the next command.
+ * A line that was read ahead is handed out first, with *parsed set to its
+ * command if it has been parsed already (and NULL otherwise).
+ * Background
+ * completions and mode changes are reported before the prompt. While waiting
+ * for input the event loop keeps running, and anything that happens meanwhile
+ * is reported straight away, followed by a fresh prompt.
+ * Output: the line that was read, or NULL once the input has ended
+*******************************************************************************/
+char* prompt(processes* procs, command** parsed) {
+  char* line;
+
+  /* pick up anything that happened since the last prompt. a script only has
+     something to pick up while it has background processes running */
+  if(interactive || procs->size > 0) {
+    handleEvents(0);
+  }
+  cleanupProcs(procs);
+  displayBGMessage();
+
+  /* display initial prompt */
+  printPrompt();
+
+  line = nextAheadLine(parsed);
+  if(line != NULL) {
+    return line;
+  }
+
+  waitingAtPrompt = TRUE;
+  while((line = readerNextLine(&input)) == NULL && !input.eof) {
+    /* nothing stays buffered while the shell waits for more input */
+    fflush(stdout);
+    if(!input.pollable || input.ready) {
+      input.ready = FALSE;
+      readerFill(&input);
+      continue;
+    }
+    if(!input.armed) {
+      struct epoll_event event = {0};
+      event.events = EPOLLIN | EPOLLONESHOT;
+      event.data.fd = STDIN_FILENO;
+      epoll_ctl(epollFd, EPOLL_CTL_MOD, STDIN_FILENO, &event);
+      input.armed = TRUE;
+    }
+    handleEvents(-1);
+    /* a job being continued is not reported, so it needs no fresh prompt */
+    int report = FALSE;
+    unsigned i;
+    for(i = completionTail; i != completionHead; ++i) {
+      report |= !WIFCONTINUED(completionRing[i % COMPLETION_RING_SIZE].results);
+    }
+    if(completionHead != completionTail) {
+      if(interactive && report) {
+        write(STDOUT_FILENO, "\n", 1);
+      }
+      cleanupProcs(procs);
+      if(report) {
+        printPrompt();
+      }
+    }
+  }
+  waitingAtPrompt = FALSE;
+
+  return line;
+}
+
+
+/*******************************************************************************
+ *                            struct Builtin
+ * A built-in command: its name and the function that runs it. Every handler
+ * takes the command's arguments, the background processes and the status of
+ * the last foreground command. The built-ins are listed in BUILTINS.
+ * A built-in that stands in for a program of the same name (echo, test, ...)
+ * is marked external. It runs inside the shell only in the foreground. In
+ * the background, timed with "time" or limited with "limit", the program is
+ * started instead. kill is not marked, although there is a program of that
+ * name, since the program does not know the %N job names.
+*******************************************************************************/
+typedef void (*builtinHandler)(char** args, processes* procs, result* status);
+
+typedef struct Builtin {
+  char* name;
+  builtinHandler handler;
+  int external;
+} builtin;
+
+
+/*******************************************************************************
+ *                         struct ParseCache
+ * Scripts tend to run the same lines again and again, so the most recently
+ * parsed lines are remembered with their parsed commands and the built-in
+ * they run. When a line comes round again its cached command is run as it is,
+ * without the line being tokenized or parsed. The cache holds
+ * PARSE_CACHE_SIZE lines; the entries are chained into buckets by the hash of
+ * their line and kept in a doubly linked list from the most (first) to the
+ * least (last) recently used, which is the one that makes way for a new line.
+ * Only lines whose parse cannot change are cached: $$ always expands to the
+ * same pid, but a line with any other expansion is parsed every time.
+*******************************************************************************/
+typedef struct ParsedLine {
+  char* line;
+  unsigned long hash;
+  command parsed;
+  builtin* builtinCommand;
+  int hashNext;
+  int prev;
+  int next;
+} parsedLine;
+
+typedef struct ParseCache {
+  parsedLine entries[PARSE_CACHE_SIZE];
+  int buckets[PARSE_CACHE_SIZE];
+  int size;
+  int first;
+  int last;
+} parseCache;
+
+parseCache lineCache;
+
+
+/*******************************************************************************
+ *                  void parseCacheUnlink(int index)
+ * Description: takes an entry out of the recently used list
+*******************************************************************************/
+void parseCacheUnlink(int index) {
+  parsedLine* entry = &lineCache.entries[index];
+  if(entry->prev != -1) {
+    lineCache.entries[entry->prev].next = entry->next;
+  }
+  else {
+    lineCache.first = entry->next;
+  }
+  if(entry->next != -1) {
+    lineCache.entries[entry->next].prev = entry->prev;
+  }
+  else {
+    lineCache.last = entry->prev;
+  }
+}
+
+
+/*******************************************************************************
+ *                  void parseCachePushFront(int index)
+ * Description: makes an entry the most recently used
+*******************************************************************************/
+void parseCachePushFront(int index) {
+  parsedLine* entry = &lineCache.entries[index];
+  entry->prev = -1;
+  entry->next = lineCache.first;
+  if(lineCache.first != -1) {
+    lineCache.entries[lineCache.first].prev = index;
+  }
+  else {
+    lineCache.last = index;
+  }
+  lineCache.first = index;
+}
+
+
+/*******************************************************************************
+ *                  parsedLine* parseCacheFind(char* line)
+ * Description: looks a line up in the cache, and makes it the most recently
+ *   used if it is there
+ * Output: the line's entry, or NULL
+*******************************************************************************/
+parsedLine* parseCacheFind(char* line) {
+  if(lineCache.size == 0) {
+    return NULL;
+  }
+  unsigned long hash = hashString(line);
+  int index = lineCache.buckets[hash & (PARSE_CACHE_SIZE - 1)];
+  while(index != -1 && (lineCache.entries[index].hash != hash ||
+                        strcmp(lineCache.entries[index].line, line) != 0)) {
+    index = lineCache.entries[index].hashNext;
+  }
+  if(index == -1) {
+    return NULL;
+  }
+  if(lineCache.first != index) {
+    parseCacheUnlink(index);
+    parseCachePushFront(index);
+  }
+  return &lineCache.entries[index];
+}
+
+
+/*******************************************************************************
+ *  void parseCacheStore(char* line, command* cmd, builtin* builtinCommand)
+ * Description: remembers the line that has just been parsed into cmd. Once
+ *   the cache is full the least recently used line is forgotten to make room,
+ *   and its command is reused for the new one.
+*******************************************************************************/
+void parseCacheStore(char* line, command* cmd, builtin* builtinCommand) {
+  int index;
+  int* link;
+
+  if(!isCacheable(line)) {
+    return;
+  }
+
+  if(lineCache.size == 0) {
+    for(index = 0; index < PARSE_CACHE_SIZE; ++index) {
+      lineCache.buckets[index] = -1;
+    }
+    lineCache.first = -1;
+    lineCache.last = -1;
+  }
+
+  if(lineCache.size < PARSE_CACHE_SIZE) {
+    index = lineCache.size;
+    lineCache.size += 1;
+    initializeCommand(&lineCache.entries[index].parsed, cmd->numArgs + 1);
+  }
+  else {
+    /* the least recently used entry is taken out of its bucket and reused */
+    index = lineCache.last;
+    parsedLine* old = &lineCache.entries[index];
+    link = &lineCache.buckets[old->hash & (PARSE_CACHE_SIZE - 1)];
+    while(*link != index) {
+      link = &lineCache.entries[*link].hashNext;
+    }
+    *link = old->hashNext;
+    parseCacheUnlink(index);
+    free(old->line);
+  }
+
+  parsedLine* entry = &lineCache.entries[index];
+  entry->line = strdup(line);
+  assert(entry->line != NULL);
+  entry->hash = hashString(line);
+  copyCommand(cmd, &entry->parsed);
+  entry->builtinCommand = builtinCommand;
+  link = &lineCache.buckets[entry->hash & (PARSE_CACHE_SIZE - 1)];
+  entry->hashNext = *link;
+  *link = index;
+  parseCachePushFront(index);
+}
+
+
+/*******************************************************************************
+ *                       void destroyParseCache()
+ * Description: frees all memory held by the parse cache
+*******************************************************************************/
+void destroyParseCache() {
+  int i;
+  for(i = 0; i < lineCache.size; ++i) {
+    free(lineCache.entries[i].line);
+    destroyCommand(&lineCache.entries[i].parsed);
+  }
+  lineCache.size = 0;
+}
+
+
+/*******************************************************************************
+ *                              history
+ * Every line read at the prompt is appended to a history log, which is kept
+ * in two files:
+ *   - the log itself, with one line per entry, only ever appended to.
+ *   - an index beside it (the log's name plus ".idx") that holds the offset
+ *     and length of each entry in the log as a historyEntry.
+ * Starting up only opens the two files and divides the size of the index by
+ * the size of an entry, however long the history is. Entries are read through
+ * read-only mappings of the files, which are only made (or enlarged) when an
+ * entry is asked for, so nothing is copied out of the log except the one line
+ * that is being re-run. Both files are opened with O_APPEND and an entry is
+ * only added to the index once its line is in the log, so shells sharing a
+ * history never see an entry that is not there.
+ * The history is in $HOME/.smallsh_history, or SMALLSH_HISTORY if that is set
+ * (to nothing to turn history off). A shell that is not interactive only
+ * keeps a history when SMALLSH_HISTORY is set.
+*******************************************************************************/
+typedef struct HistoryEntry {
+  long offset;
+  long length;
+} historyEntry;
+
+typedef struct History {
+  int logFd;
+  int indexFd;
+  long count;
+  char* log;
+  size_t logMapped;
+  historyEntry* index;
+  size_t indexMapped;
+  char* line;
+  size_t lineCapacity;
+  int opened;
+} history;
+
+history commandHistory = {-1, -1, 0, NULL, 0, NULL, 0, NULL, 0, FALSE};
+
+
+/*******************************************************************************
+ *                          void historyCount()
+ * Description: counts the entries from the size of the index. Other shells
+ *   may have added to a shared history since it was last counted, so this is
+ *   done before every lookup.
+*******************************************************************************/
+void historyCount() {
+  struct stat indexInfo;
+  if(commandHistory.indexFd != -1 &&
+     fstat(commandHistory.indexFd, &indexInfo) == 0) {
+    commandHistory.count = indexInfo.st_size / sizeof(historyEntry);
+  }
+}
+
+
+/*******************************************************************************
+ *                           void historyOpen()
+ * Description: opens (creating them if needed) the history log and its index.
+ *   This is done the first time the history is used, not at startup.
+*******************************************************************************/
+void historyOpen() {
+  if(commandHistory.opened) {
+    return;
+  }
+  commandHistory.opened = TRUE;
+
+  /* HOME is only looked up, loading the variables, when it is needed */
+  char* fileName = getenv("SMALLSH_HISTORY");
+  char* home = NULL;
+  char* path;
+
+  if(fileName == NULL && !interactive) {
+    return;
+  }
+  if(fileName != NULL && fileName[0] == '\0') {
+    return;
+  }
+  if(fileName == NULL) {
+    home = getVariable("HOME", 4);
+    if(home == NULL) {
+      return;
+    }
+  }
+  if(fileName != NULL) {
+    path = malloc(strlen(fileName) + 5);
+    assert(path != NULL);
+    strcpy(path, fileName);
+  }
+  else {
+    path = malloc(strlen(home) + 21);
+    assert(path != NULL);
+    sprintf(path, "%s/.smallsh_history", home);
+  }
+
+  commandHistory.logFd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC,
+                              0600);
+  strcat(path, ".idx");
+  commandHistory.indexFd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC,
+                                0600);
+  free(path);
+  if(commandHistory.logFd == -1 || commandHistory.indexFd == -1) {
+    printf("history: cannot open the history file\n");
+    flushOutput();
+    if(commandHistory.logFd != -1) {
+      close(commandHistory.logFd);
+    }
+    if(commandHistory.indexFd != -1) {
+      close(commandHistory.indexFd);
+    }
+    commandHistory.logFd = -1;
+    commandHistory.indexFd = -1;
+    return;
+  }
+
+  historyCount();
+}
+
+
+/*******************************************************************************
+ *                          void historyClose()
+ * Description: unmaps and closes the history files
+*******************************************************************************/
+void historyClose() {
+  if(commandHistory.log != NULL) {
+    munmap(commandHistory.log, commandHistory.logMapped);
+  }
+  if(commandHistory.index != NULL) {
+    munmap(commandHistory.index, commandHistory.indexMapped);
+  }
+  if(commandHistory.logFd != -1) {
+    close(commandHistory.logFd);
+    close(commandHistory.indexFd);
+  }
+  free(commandHistory.line);
+  commandHistory.log = NULL;
+  commandHistory.index = NULL;
+  commandHistory.line = NULL;
+  commandHistory.logFd = -1;
+  commandHistory.indexFd = -1;
+}
+
+
+/*******************************************************************************
+ *                       void historyAdd(char* line)
+ * Description: appends a line to the history. Blank lines are not kept.
+*******************************************************************************/
+void historyAdd(char* line) {
+  historyOpen();
+  if(commandHistory.logFd == -1 || line[strspn(line, " \t")] == '\0') {
+    return;
+  }
+
+  /* the line and its newline are written together so that the log never
+     holds half an entry. With O_APPEND the file offset afterwards is the end
+     of what was written, even if another shell appended in the meantime */
+  size_t length = strlen(line);
+  struct iovec pieces[2] = {{line, length}, {"\n", 1}};
+  if(writev(commandHistory.logFd, pieces, 2) != (ssize_t)(length + 1)) {
+    return;
+  }
+
+  historyEntry entry;
+  entry.length = length;
+  entry.offset = lseek(commandHistory.logFd, 0, SEEK_CUR) - (length + 1);
+  if(write(commandHistory.indexFd, &entry, sizeof(historyEntry)) ==
+     sizeof(historyEntry)) {
+    historyCount();
+  }
+}
+
+
+/*******************************************************************************
+ *           int historyMap(int fd, char** map, size_t* mapped, size_t needed)
+ * Description: makes sure at least needed bytes of a history file are mapped,
+ *   mapping the whole file again if it has grown past the current mapping
+ * Output: TRUE if they are
+*******************************************************************************/
+int historyMap(int fd, char** map, size_t* mapped, size_t needed) {
+  if(needed <= *mapped) {
+    return TRUE;
+  }
+  struct stat fileInfo;
+  if(fstat(fd, &fileInfo) == -1 || (size_t)fileInfo.st_size < needed) {
+    return FALSE;
+  }
+  if(*map != NULL) {
+    munmap(*map, *mapped);
+  }
+  *map = mmap(NULL, fileInfo.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if(*map == MAP_FAILED) {
+    *map = NULL;
+    *mapped = 0;
+    return FALSE;
+  }
+  *mapped = fileInfo.st_size;
+  return TRUE;
+}
+
+
+/*******************************************************************************
+ *                 char* historyGet(long number, long* length)
+ * Description: finds entry number (counting from 1) of the history in the
+ *   mapped log. The entry is not null-terminated.
+ * Output: the start of the entry, with its length in length, or NULL if there
+ *   is no such entry or the index gives it a place outside the log
+*******************************************************************************/
+char* historyGet(long number, long* length) {
+  if(commandHistory.logFd == -1 || number < 1 ||
+     number > commandHistory.count) {
+    return NULL;
+  }
+  if(!historyMap(commandHistory.indexFd, (char**)&commandHistory.index,
+                 &commandHistory.indexMapped,
+                 number * sizeof(historyEntry))) {
+    return NULL;
+  }
+  historyEntry* entry = &commandHistory.index[number - 1];
+  if(entry->offset < 0 || entry->length < 0 ||
+     !historyMap(commandHistory.logFd, &commandHistory.log,
+                 &commandHistory.logMapped,
+                 (size_t)entry->offset + entry->length) ||
+     (size_t)entry->offset > commandHistory.logMapped ||
+     (size_t)entry->length > commandHistory.logMapped - entry->offset) {
+    return NULL;
+  }
+  *length = entry->length;
+  return commandHistory.log + entry->offset;
+}
+
+
+/*******************************************************************************
+ *                    char* historyExpand(char* line)
+ * Description: replaces a line of the form !N with entry N of the history,
+ *   !-N with the Nth entry from the end and !! with the last one. The line
+ *   that will be run is printed, as other shells do.
+ * Output: the line to run, which may be line itself, or NULL if the entry
+ *   does not exist
+*******************************************************************************/
+char* historyExpand(char* line) {
+  char* event = line + strspn(line, " \t");
+  if(event[0] != '!' || event[1] == '\0') {
+    return line;
+  }
+  historyOpen();
+  historyCount();
+
+  char* end;
+  long number;
+  if(event[1] == '!') {
+    number = commandHistory.count;
+    end = event + 2;
+  }
+  else {
+    number = strtol(event + 1, &end, 10);
+    if(end == event + 1) {
+      return line;
+    }
+    if(number < 0) {
+      number += commandHistory.count + 1;
+    }
+  }
+  if(end[strspn(end, " \t")] != '\0') {
+    return line;
+  }
+
+  long length;
+  char* entry = historyGet(number, &length);
+  if(entry == NULL) {
+    printf("%s: event not found\n", event);
+    flushOutput();
+    return NULL;
+  }
+  if(commandHistory.lineCapacity < (size_t)length + 2) {
+    commandHistory.lineCapacity = length + 2;
+    commandHistory.line = realloc(commandHistory.line,
+                                  commandHistory.lineCapacity);
+    assert(commandHistory.line != NULL);
+  }
+  memcpy(commandHistory.line, entry, length);
+  commandHistory.line[length] = '\0';
+  printf("%s\n", commandHistory.line);
+  flushOutput();
+  return commandHistory.line;
+}
+
+
+/*******************************************************************************
+ *         void historyCommand(char** args, processes* procs, result* status)
+ * Description: the history built-in. Lists the history with the number of
+ *   each entry, or with "history N" only the last N entries. An N that is not
+ *   a number of 0 or more is an error.
+*******************************************************************************/
+void historyCommand(char** args, processes* procs, result* status) {
+  long first = 1;
+  long last = -1;
+  long number;
+  long length;
+
+  if(args[1] != NULL) {
+    char* end;
+    errno = 0;
+    last = strtol(args[1], &end, 10);
+    if(end == args[1] || *end != '\0' || last < 0 || errno == ERANGE) {
+      printf("history: %s: not a number\n", args[1]);
+      flushOutput();
+      status->sig = FALSE;
+      status->code = 1;
+      return;
+    }
+  }
+
+  historyOpen();
+  historyCount();
+  if(last != -1 && last < commandHistory.count) {
+    first = commandHistory.count - last + 1;
+  }
+  for(number = first; number <= commandHistory.count; ++number) {
+    char* entry = historyGet(number, &length);
+    if(entry != NULL) {
+      printf("%5ld  %.*s\n", number, (int)length, entry);
+    }
+  }
+  flushOutput();
+}
+
+
+/*******************************************************************************
+ *                    void writeStatsFile(char* fileName)
+ * Description: writes every counter to fileName as JSON, in the form
+ *   {"getArgs": {"count": 3, "total_ns": 900, "max_ns": 400,
+ *                "buckets": [0, 0, ...]}, ...}
+ *   where bucket i counts the samples under 2^i nanoseconds
+*******************************************************************************/
+void writeStatsFile(char* fileName) {
+  FILE* file = fopen(fileName, "w");
+  if(file == NULL) {
+    printf("stats: cannot open %s for output\n", fileName);
+    flushOutput();
+    return;
+  }
+  int i;
+  int j;
+  fprintf(file, "{");
+  for(i = 0; i < NUM_STATS; ++i) {
+    statCounter* stat = &statCounters[i];
+    fprintf(file, "%s\n  \"%s\": {\"count\": %lu, \"total_ns\": %lu, "
+            "\"max_ns\": %lu, \"buckets\": [", i == 0 ? "" : ",", stat->name,
+            stat->count, stat->totalNs, stat->maxNs);
+    for(j = 0; j < STATS_BUCKETS; ++j) {
+      fprintf(file, "%s%lu", j == 0 ? "" : ", ", stat->buckets[j]);
+    }
+    fprintf(file, "]}");
+  }
+  fprintf(file, "\n}\n");
+  fclose(file);
+}
+
+
+/*******************************************************************************
+ *          void statsCommand(char** args, processes* procs, result* status)
+ * Description: the stats built-in. Prints, for each counter, how many samples
+ *   there were and their mean, median, 99th percentile and longest time in
+ *   microseconds. "stats -r" zeroes the counters and "stats file" writes them
+ *   to file as JSON. With SMALLSH_STATS_FILE set, the counters are also
+ *   written to that file when the shell exits.
+*******************************************************************************/
+void statsCommand(char** args, processes* procs, result* status) {
+#ifndef SMALLSH_STATS
+  printf("stats: not available, smallsh was built without SMALLSH_STATS\n");
+  flushOutput();
+#else
+  int i;
+  if(args[1] != NULL && strcmp(args[1], "-r") == 0) {
+    for(i = 0; i < NUM_STATS; ++i) {
+      char* name = statCounters[i].name;
+      memset(&statCounters[i], 0, sizeof(statCounter));
+      statCounters[i].name = name;
+    }
+    return;
+  }
+  if(args[1] != NULL) {
+    writeStatsFile(args[1]);
+    return;
+  }
+
+  printf("%-14s %10s %10s %10s %10s %10s\n", "counter", "count", "mean us",
+         "p50 us", "p99 us", "max us");
+  for(i = 0; i < NUM_STATS; ++i) {
+    statCounter* stat = &statCounters[i];
+    printf("%-14s %10lu %10.3f %10.3f %10.3f %10.3f\n", stat->name,
+           stat->count, stat->count == 0 ? 0.0 :
+           stat->totalNs / 1000.0 / stat->count,
+           statsPercentile(stat, 50) / 1000.0,
+           statsPercentile(stat, 99) / 1000.0, stat->maxNs / 1000.0);
+  }
+  flushOutput();
+#endif
+}
+
+
+/*******************************************************************************
+ *                        the small built-ins
+ * The built-ins that need nothing more than a few lines.
+ *   cd - changes to the directory in args[1], or HOME without one
+ *   status - prints the exit value or terminating signal of the most recently
+ *     terminated foreground process
+ *   exit - waits for any queued background commands, cleans up and exits
+ *   rehash - empties the command location cache
+*******************************************************************************/
+void cdCommand(char** args, processes* procs, result* status) {
+  changeDirectory(args[1]);
+}
+
+void statusCommand(char** args, processes* procs, result* status) {
+  if(status->sig == FALSE) {
+    printf("exit value %d\n", status->code);
+    flushOutput();
+  }
+  else {
+    printf("terminated by signal %d\n", status->code);
+    flushOutput();
+  }
+}
+
+void exitCommand(char** args, processes* procs, result* status) {
+  finishQueuedJobs(procs);
+#ifdef SMALLSH_STATS
+  if(statsFileName != NULL) {
+    writeStatsFile(statsFileName);
+  }
+#endif
+  closeInput();
+  destroyPathCache();
+  destroyVariables();
+  destroyParseCache();
+  destroyParsedAhead();
+  destroyCommand(&lineCommand);
+  destroySharedInputs();
+  placementClear();
+  captureClear();
+  destroyProcessArray(procs);
+  historyClose();
+  traceClose();
+  exit(0);
+}
+
+void rehashCommand(char** args, processes* procs, result* status) {
+  pathCacheClear();
+}
+
+
+/*******************************************************************************
+ *          char* writeEscape(char* source, int zeroOctal, int* stop)
+ * Description: writes the character a backslash escape stands for, as echo -e
+ *   and printf understand them: \a \b \e \f \n \r \t \v \\, \xHH with one or
+ *   two hex digits and an octal number of up to three digits. With zeroOctal
+ *   the octal number is written \0NNN (echo and %b), otherwise \NNN (printf
+ *   formats). \c sets *stop, ending the output. Any other escape is written
+ *   as it is.
+ * Input: source points just after the backslash
+ * Output: the character after the escape
+*******************************************************************************/
+char* writeEscape(char* source, int zeroOctal, int* stop) {
+  int value = 0;
+  int digits = 0;
+
+  switch(*source) {
+    case 'a': putchar('\a'); return source + 1;
+    case 'b': putchar('\b'); return source + 1;
+    case 'e': putchar('\033'); return source + 1;
+    case 'f': putchar('\f'); return source + 1;
+    case 'n': putchar('\n'); return source + 1;
+    case 'r': putchar('\r'); return source + 1;
+    case 't': putchar('\t'); return source + 1;
+    case 'v': putchar('\v'); return source + 1;
+    case '\\': putchar('\\'); return source + 1;
+    case 'c':
+      *stop = TRUE;
+      return source + 1;
+    case 'x':
+      while(digits < 2 && isxdigit((unsigned char)source[1 + digits])) {
+        char digit = tolower((unsigned char)source[1 + digits]);
+        value = value * 16 + (isdigit((unsigned char)digit) ? digit - '0' :
+                              digit - 'a' + 10);
+        digits++;
+      }
+      if(digits == 0) {
+        break;
+      }
+      putchar(value);
+      return source + 1 + digits;
+    case '\0':
+      putchar('\\');
+      return source;
+  }
+
+  if(*source >= '0' && *source <= '7' && (!zeroOctal || *source == '0')) {
+    char* octal = zeroOctal ? source + 1 : source;
+    while(digits < 3 && octal[digits] >= '0' && octal[digits] <= '7') {
+      value = value * 8 + octal[digits] - '0';
+      digits++;
+    }
+    putchar(value & 0xff);
+    return octal + digits;
+  }
+  putchar('\\');
+  putchar(*source);
+  return source + 1;
+}
+
+
+/*******************************************************************************
+ *                  void builtinError(char* format, ...)
+ * Description: writes a built-in's error message to stderr, after anything
+ *   the shell has buffered for stdout so that the two come out in order
+*******************************************************************************/
+void builtinError(char* format, ...) {
+  va_list arguments;
+  fflush(stdout);
+  va_start(arguments, format);
+  vfprintf(stderr, format, arguments);
+  va_end(arguments);
+}
+
+
+/*******************************************************************************
+ *              void setStatus(result* status, int code)
+ * Description: records the exit value of a built-in that stands in for a
+ *   program, as if that program had run in the foreground
+*******************************************************************************/
+void setStatus(result* status, int code) {
+  status->sig = FALSE;
+  status->code = code;
+}
+
+
+/*******************************************************************************
+ *          void echoCommand(char** args, processes* procs, result* status)
+ * Description: the echo built-in, which behaves like /bin/echo: it writes its
+ *   arguments separated by spaces and followed by a newline. Leading options
+ *   made up of n, e and E leave the newline out (-n), and turn escapes on
+ *   (-e) or off (-E, the default).
+*******************************************************************************/
+void echoCommand(char** args, processes* procs, result* status) {
+  int newline = TRUE;
+  int escapes = FALSE;
+  int stop = FALSE;
+  int i = 1;
+
+  for(; args[i] != NULL && args[i][0] == '-' && args[i][1] != '\0'; ++i) {
+    if(strspn(args[i] + 1, "neE") != strlen(args[i] + 1)) {
+      break;
+    }
+    char* option;
+    for(option = args[i] + 1; *option != '\0'; ++option) {
+      if(*option == 'n') {
+        newline = FALSE;
+      }
+      else {
+        escapes = *option == 'e';
+      }
+    }
+  }
+
+  for(; args[i] != NULL && !stop; ++i) {
+    char* word = args[i];
+    if(!escapes) {
+      fputs(word, stdout);
+    }
+    while(escapes && *word != '\0' && !stop) {
+      if(*word == '\\') {
+        word = writeEscape(word + 1, TRUE, &stop);
+      }
+      else {
+        putchar(*word);
+        word++;
+      }
+    }
+    if(args[i + 1] != NULL && !stop) {
+      putchar(' ');
+    }
+  }
+  if(newline && !stop) {
+    putchar('\n');
+  }
+  flushOutput();
+  setStatus(status, 0);
+}
+
+
+/*******************************************************************************
+ *     void trueCommand / falseCommand(char** args, processes*, result*)
+ * Description: the true and false built-ins, which do nothing but set the exit
+ *   value to 0 and 1
+*******************************************************************************/
+void trueCommand(char** args, processes* procs, result* status) {
+  setStatus(status, 0);
+}
+
+void falseCommand(char** args, processes* procs, result* status) {
+  setStatus(status, 1);
+}
+
+
+/*******************************************************************************
+ *                           struct TestState
+ * The arguments of a test expression, how far into them the parse has got and
+ * whether it has found a mistake
+*******************************************************************************/
+typedef struct TestState {
+  char** args;
+  int count;
+  int index;
+  int error;
+} testState;
+
+
+/*******************************************************************************
+ *          long testInteger(testState* state, char* word)
+ * Description: reads an integer operand, noting a mistake if it is not one
+*******************************************************************************/
+long testInteger(testState* state, char* word) {
+  char* end;
+  errno = 0;
+  long value = strtol(word, &end, 10);
+  if(end == word || end[strspn(end, " \t")] != '\0' || errno != 0) {
+    builtinError("test: %s: integer expression expected\n", word);
+    state->error = TRUE;
+  }
+  return value;
+}
+
+
+/*******************************************************************************
+ *               int isTestUnary(char* word) / isTestBinary(char* word)
+ * Description: decide whether a word is one of the unary (file and string)
+ *   or binary (string and integer comparison) operators test understands
+*******************************************************************************/
+int isTestUnary(char* word) {
+  return word[0] == '-' && word[1] != '\0' && word[2] == '\0' &&
+         strchr("bcdefghkLnprsSuwxz", word[1]) != NULL;
+}
+
+int isTestBinary(char* word) {
+  char* operators[] = {"=", "==", "!=", "-eq", "-ne", "-lt", "-le",
+                       "-gt", "-ge", NULL};
+  int i;
+  for(i = 0; operators[i] != NULL; ++i) {
+    if(strcmp(word, operators[i]) == 0) {
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+
+/*******************************************************************************
+ *              int testUnary(char op, char* operand)
+ * Description: evaluates -n and -z on a string, or a file test on a path
+*******************************************************************************/
+int testUnary(char op, char* operand) {
+  struct stat fileInfo;
+  if(op == 'n') {
+    return operand[0] != '\0';
+  }
+  if(op == 'z') {
+    return operand[0] == '\0';
+  }
+  if(op == 'h' || op == 'L') {
+    return lstat(operand, &fileInfo) == 0 && S_ISLNK(fileInfo.st_mode);
+  }
+  if(op == 'r' || op == 'w' || op == 'x') {
+    return access(operand, op == 'r' ? R_OK : op == 'w' ? W_OK : X_OK) == 0;
+  }
+  if(stat(operand, &fileInfo) != 0) {
+    return FALSE;
+  }
+  switch(op) {
+    case 'b': return S_ISBLK(fileInfo.st_mode);
+    case 'c': return S_ISCHR(fileInfo.st_mode);
+    case 'd': return S_ISDIR(fileInfo.st_mode);
+    case 'f': return S_ISREG(fileInfo.st_mode);
+    case 'g': return (fileInfo.st_mode & S_ISGID) != 0;
+    case 'k': return (fileInfo.st_mode & S_ISVTX) != 0;
+    case 'p': return S_ISFIFO(fileInfo.st_mode);
+    case 's': return fileInfo.st_size > 0;
+    case 'S': return S_ISSOCK(fileInfo.st_mode);
+    case 'u': return (fileInfo.st_mode & S_ISUID) != 0;
+  }
+  /* -e */
+  return TRUE;
+}
+
+
+/*******************************************************************************
+ *         int testBinary(testState* state, char* left, char* op, char* right)
+ * Description: evaluates a string or integer comparison
+*******************************************************************************/
+int testBinary(testState* state, char* left, char* op, char* right) {
+  if(op[0] != '-') {
+    int same = strcmp(left, right) == 0;
+    return op[0] == '!' ? !same : same;
+  }
+  long a = testInteger(state, left);
+  long b = testInteger(state, right);
+  if(strcmp(op, "-eq") == 0) return a == b;
+  if(strcmp(op, "-ne") == 0) return a != b;
+  if(strcmp(op, "-lt") == 0) return a < b;
+  if(strcmp(op, "-le") == 0) return a <= b;
+  if(strcmp(op, "-gt") == 0) return a > b;
+  return a >= b;
+}
+
+
+/*******************************************************************************
+ *                           test expressions
+ * testOr evaluates the expression in state and returns whether it is true. The
+ * expression is read by recursive descent, one function for each level:
+ *     or      := and [-o and]...
+ *     and     := not [-a not]...
+ *     not     := ! not | primary
+ *     primary := STRING OP STRING | -OP STRING | STRING
+ *   Parentheses are not understood. A binary comparison is preferred to the
+ *   other readings of three words, so "test -n = -n" compares two strings,
+ *   and an operator without its operands is just a string, so "test -z" is
+ *   true.
+*******************************************************************************/
+int testPrimary(testState* state) {
+  char** args = state->args + state->index;
+  int left = state->count - state->index;
+
+  if(left <= 0) {
+    builtinError("test: argument expected\n");
+    state->error = TRUE;
+    return FALSE;
+  }
+  if(left >= 3 && isTestBinary(args[1])) {
+    state->index += 3;
+    return testBinary(state, args[0], args[1], args[2]);
+  }
+  if(left >= 2 && isTestUnary(args[0])) {
+    state->index += 2;
+    return testUnary(args[0][1], args[1]);
+  }
+  state->index += 1;
+  return args[0][0] != '\0';
+}
+
+int testNot(testState* state) {
+  if(state->index < state->count - 1 &&
+     strcmp(state->args[state->index], "!") == 0) {
+    state->index += 1;
+    return !testNot(state);
+  }
+  return testPrimary(state);
+}
+
+int testAnd(testState* state) {
+  int value = testNot(state);
+  while(!state->error && state->index < state->count - 1 &&
+        strcmp(state->args[state->index], "-a") == 0) {
+    state->index += 1;
+    value = testNot(state) && value;
+  }
+  return value;
+}
+
+int testOr(testState* state) {
+  int value = testAnd(state);
+  while(!state->error && state->index < state->count - 1 &&
+        strcmp(state->args[state->index], "-o") == 0) {
+    state->index += 1;
+    value = testAnd(state) || value;
+  }
+  return value;
+}
+
+
+/*******************************************************************************
+ *          void testCommand(char** args, processes* procs, result* status)
+ * Description: the test and [ built-ins, which behave like /usr/bin/test: the
+ *   exit value is 0 when the expression is true, 1 when it is false and 2
+ *   when it cannot be understood. [ needs a closing ] as its last argument.
+ *   No arguments at all are false.
+*******************************************************************************/
+void testCommand(char** args, processes* procs, result* status) {
+  testState state = {args + 1, 0, 0, FALSE};
+  while(state.args[state.count] != NULL) {
+    state.count++;
+  }
+  if(args[0][0] == '[') {
+    if(state.count == 0 || strcmp(state.args[state.count - 1], "]") != 0) {
+      builtinError("[: missing ']'\n");
+      setStatus(status, 2);
+      return;
+    }
+    state.count--;
+  }
+  if(state.count == 0) {
+    setStatus(status, 1);
+    return;
+  }
+
+  int value = testOr(&state);
+  if(!state.error && state.index < state.count) {
+    builtinError("test: %s: unexpected argument\n", state.args[state.index]);
+    state.error = TRUE;
+  }
+  setStatus(status, state.error ? 2 : !value);
+}
+
+
+/*******************************************************************************
+ *   int printfConversion(char* spec, size_t length, char* value, int* failed,
+ *                        int* stop)
+ * Description: prints one % conversion of printf. spec is the conversion in
+ *   the format: the '%', then length - 1 characters of flags, width and
+ *   precision, then its letter. value is the argument to use, or NULL once
+ *   they have run out, which is printed as "" or 0. A number that cannot be
+ *   read sets *failed and is printed as far as it was read. 'c or "c is the
+ *   value of the character c. \c in a %b argument sets *stop.
+ * Output: FALSE if the letter is not a conversion printf knows
+*******************************************************************************/
+int printfConversion(char* spec, size_t length, char* value, int* failed,
+                     int* stop) {
+  char conversion = spec[length];
+  char format[64];
+  char* end = "";
+  long long integer = 0;
+  double real = 0;
+  int isReal = FALSE;
+
+  if(length + 4 > sizeof(format)) {
+    return FALSE;
+  }
+  memcpy(format, spec, length);
+  if(value == NULL) {
+    value = strchr("sbc", conversion) != NULL ? "" : "0";
+  }
+
+  switch(conversion) {
+    case 's':
+    case 'c':
+      format[length] = 's';
+      format[length + 1] = '\0';
+      if(conversion == 'c') {
+        char character[2] = {value[0], '\0'};
+        printf(format, character);
+      }
+      else {
+        printf(format, value);
+      }
+      return TRUE;
+
+    case 'b':
+      while(*value != '\0' && !*stop) {
+        if(*value == '\\') {
+          value = writeEscape(value + 1, TRUE, stop);
+        }
+        else {
+          putchar(*value);
+          value++;
+        }
+      }
+      return TRUE;
+
+    case 'd':
+    case 'i':
+    case 'o':
+    case 'u':
+    case 'x':
+    case 'X':
+      format[length] = 'l';
+      format[length + 1] = 'l';
+      format[length + 2] = conversion;
+      format[length + 3] = '\0';
+      errno = 0;
+      if(value[0] == '\'' || value[0] == '"') {
+        integer = (unsigned char)value[1];
+      }
+      else if(conversion == 'd' || conversion == 'i') {
+        integer = strtoll(value, &end, 0);
+      }
+      else {
+        integer = (long long)strtoull(value, &end, 0);
+      }
+      break;
+
+    case 'e':
+    case 'E':
+    case 'f':
+    case 'F':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A':
+      format[length] = conversion;
+      format[length + 1] = '\0';
+      errno = 0;
+      real = strtod(value, &end);
+      isReal = TRUE;
+      break;
+
+    default:
+      return FALSE;
+  }
+
+  if(*end != '\0' || errno != 0) {
+    builtinError("printf: %s: invalid number\n", value);
+    *failed = TRUE;
+  }
+  if(isReal) {
+    printf(format, real);
+  }
+  else {
+    printf(format, integer);
+  }
+  return TRUE;
+}
+
+
+/*******************************************************************************
+ *        void printfCommand(char** args, processes* procs, result* status)
+ * Description: the printf built-in, which behaves like /usr/bin/printf. The
+ *   format is printed with its escapes and its % conversions (with their
+ *   flags, width and precision) filled in from the arguments that follow.
+ *   The format is used again as long as it keeps using up arguments.
+ *   Conversions: %s %b %c %d %i %o %u %x %X %e %E %f %F %g %G %a %A and %%.
+*******************************************************************************/
+void printfCommand(char** args, processes* procs, result* status) {
+  if(args[1] == NULL) {
+    builtinError("printf: missing operand\n");
+    setStatus(status, 1);
+    return;
+  }
+
+  char** values = args + 2;
+  char** passStart;
+  int failed = FALSE;
+  int stop = FALSE;
+
+  do {
+    passStart = values;
+    char* format = args[1];
+    while(*format != '\0' && !stop) {
+      if(*format == '\\') {
+        format = writeEscape(format + 1, FALSE, &stop);
+      }
+      else if(*format != '%') {
+        putchar(*format);
+        format++;
+      }
+      else if(format[1] == '%') {
+        putchar('%');
+        format += 2;
+      }
+      else {
+        /* find the letter after the flags, width and precision */
+        size_t length = 1 + strspn(format + 1, "-+ #0");
+        length += strspn(format + length, "0123456789");
+        if(format[length] == '.') {
+          length += 1 + strspn(format + length + 1, "0123456789");
+        }
+        if(!printfConversion(format, length, *values, &failed, &stop)) {
+          builtinError("printf: %.*s: invalid conversion\n", (int)length + 1,
+                       format);
+          failed = TRUE;
+          stop = TRUE;
+          break;
+        }
+        if(*values != NULL) {
+          values++;
+        }
+        format += length + 1;
+      }
+    }
+  } while(!stop && *values != NULL && values != passStart);
+
+  flushOutput();
+  setStatus(status, failed ? 1 : 0);
+}
+
+
+/*******************************************************************************
+ *               int findJobNumber(processes* procs, int number)
+ * Description: finds the first process of job number
+ * Output: its slot, or -1 if the job has no processes left
+*******************************************************************************/
+int findJobNumber(processes* procs, int number) {
+  int i;
+  for(i = procs->first; i != -1; i = procs->jobs[i].next) {
+    if(procs->jobs[i].number == number && number != 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+
+/*******************************************************************************
+ *                int findJob(processes* procs, char* spec)
+ * Description: finds the job a job control built-in is given. %N is job N,
+ *   no argument (or %, %% or %+) is the most recent job, and a pid is the
+ *   job that process belongs to. Finished processes are cleaned up first so
+ *   that only jobs with processes left are found.
+ * Output: the slot of the job's first process, or -1 if there is no such job
+*******************************************************************************/
+int findJob(processes* procs, char* spec) {
+  int number = 0;
+  char* end;
+  int i;
+
+  handleEvents(0);
+  cleanupProcs(procs);
+  if(spec == NULL || strcmp(spec, "%") == 0 || strcmp(spec, "%%") == 0 ||
+     strcmp(spec, "%+") == 0) {
+    for(i = procs->first; i != -1; i = procs->jobs[i].next) {
+      if(procs->jobs[i].number > number) {
+        number = procs->jobs[i].number;
+      }
+    }
+  }
+  else if(spec[0] == '%') {
+    number = (int)strtol(spec + 1, &end, 10);
+    if(*end != '\0') {
+      number = 0;
+    }
+  }
+  else {
+    int pid = (int)strtol(spec, &end, 10);
+    i = *end == '\0' ? processesFind(procs, pid) : -1;
+    number = i == -1 ? 0 : procs->jobs[i].number;
+  }
+  return findJobNumber(procs, number);
+}
+
+
+/*******************************************************************************
+ *                int jobStopped(processes* procs, int index)
+ * Description: decides whether the job whose first process is in slot index
+ *   is stopped, which it is when any of its processes is
+ * Output: the signal that stopped the first of them, or 0 if it is running
+*******************************************************************************/
+int jobStopped(processes* procs, int index) {
+  int number = procs->jobs[index].number;
+  int i;
+  for(i = index; i != -1 && procs->jobs[i].number == number;
+      i = procs->jobs[i].next) {
+    if(procs->jobs[i].stopped) {
+      return procs->jobs[i].stopped;
+    }
+  }
+  return 0;
+}
+
+
+/*******************************************************************************
+ *       jobs, fg, bg, wait and kill built-ins. Their arguments name jobs as
+ *       findJob describes.
+ *   jobs - lists the jobs in the background, running or stopped
+ *   fg - continues a job in the foreground and waits for it, taking the
+ *     job's exit status. A job that is stopped again goes back to the list.
+ *   bg - continues a stopped job in the background
+ *   wait - waits until the jobs given (or every job, and any queued by
+ *     jobs-limit) have finished or stopped, without the shell looking at its
+ *     input. The exit status is that of the last process of the last job
+ *     given, 128 plus the signal that terminated it or, if the job stopped,
+ *     the signal that stopped it, or 128 + SIGINT when SIGINT ends the wait.
+ *   kill - sends a signal (SIGTERM, or -SIGNAL, -N or -s SIGNAL) to the
+ *     process group of each %N job and to each pid. A stopped job is
+ *     continued as well so that the signal takes effect. kill -l lists the
+ *     signal names.
+*******************************************************************************/
+void jobsCommand(char** args, processes* procs, result* status) {
+  handleEvents(0);
+  cleanupProcs(procs);
+  int i = procs->first;
+  while(i != -1) {
+    if(procs->jobs[i].number == 0) {
+      i = procs->jobs[i].next;
+      continue;
+    }
+    i = printJob(procs, i);
+  }
+  flushOutput();
+}
+
+void fgCommand(char** args, processes* procs, result* status) {
+  int index = findJob(procs, args[1]);
+  if(index == -1) {
+    builtinError("fg: %s: no such job\n", args[1] ? args[1] : "current");
+    setStatus(status, 1);
+    return;
+  }
+  int number = procs->jobs[index].number;
+  int pgid = procs->jobs[index].pgid;
+  char* name = strdup(procs->jobs[index].name);
+  char* cgroup = procs->jobs[index].cgroup == NULL ? NULL :
+                 strdup(procs->jobs[index].cgroup);
+
+  /* its processes are waited for as a foreground job from now on */
+  numForegroundPids = 0;
+  foregroundRemaining = 0;
+  memset(&foregroundUsage, 0, sizeof(struct rusage));
+  clock_gettime(CLOCK_MONOTONIC, &foregroundStarted);
+  foregroundEnded = foregroundStarted;
+  while(index != -1 && procs->jobs[index].number == number) {
+    int pid = procs->jobs[index].pid;
+    placementRelease(procs->jobs[index].place);
+    index = procs->jobs[index].next;
+    foregroundAdd(pid);
+    processesRemove(procs, pid);
+  }
+
+  printf("%s\n", name);
+  flushOutput();
+  int ownsTerminal = isatty(STDIN_FILENO) &&
+                     tcsetpgrp(STDIN_FILENO, pgid) == 0;
+  kill(-pgid, SIGCONT);
+  if(waitForeground(procs, status, pgid, ownsTerminal)) {
+    setForegroundStatus(status, foregroundResults, cgroup);
+    if(cgroup != NULL) {
+      rmdir(cgroup);
+    }
+  }
+  else {
+    stopForeground(procs, status, number, pgid, name, cgroup);
+  }
+  free(name);
+  free(cgroup);
+}
+
+void bgCommand(char** args, processes* procs, result* status) {
+  int index = findJob(procs, args[1]);
+  if(index == -1) {
+    builtinError("bg: %s: no such job\n", args[1] ? args[1] : "current");
+    return;
+  }
+  int number = procs->jobs[index].number;
+  int i;
+  for(i = index; i != -1 && procs->jobs[i].number == number;
+      i = procs->jobs[i].next) {
+    processesSetStopped(procs, i, 0);
+  }
+  kill(-procs->jobs[index].pgid, SIGCONT);
+  printJob(procs, index);
+  flushOutput();
+}
+
+void waitCommand(char** args, processes* procs, result* status) {
+  int i;
+  interruptReceived = FALSE;
+  setStatus(status, 0);
+
+  if(args[1] == NULL) {
+    while(!interruptReceived &&
+          (procs->size > procs->numStopped || queueHead != NULL)) {
+      fflush(stdout);
+      handleEvents(parseAhead(status, procs) ? 0 : -1);
+      cleanupProcs(procs);
+    }
+  }
+
+  for(i = 1; args[i] != NULL && !interruptReceived; ++i) {
+    int index = findJob(procs, args[i]);
+    if(index == -1) {
+      builtinError("wait: %s: no such job\n", args[i]);
+      setStatus(status, 127);
+      continue;
+    }
+
+    /* the status kept is that of the job's last process */
+    int number = procs->jobs[index].number;
+    int last = index;
+    while(procs->jobs[last].next != -1 &&
+          procs->jobs[procs->jobs[last].next].number == number) {
+      last = procs->jobs[last].next;
+    }
+    procs->waitPid = procs->jobs[last].pid;
+    int stopSignal = 0;
+    while(!interruptReceived && index != -1 &&
+          (stopSignal = jobStopped(procs, index)) == 0) {
+      fflush(stdout);
+      handleEvents(parseAhead(status, procs) ? 0 : -1);
+      cleanupProcs(procs);
+      index = findJobNumber(procs, number);
+    }
+    procs->waitPid = 0;
+
+    if(index != -1) {
+      setStatus(status, 128 + stopSignal);
+    }
+    else if(WIFEXITED(procs->waitResults)) {
+      setStatus(status, WEXITSTATUS(procs->waitResults));
+    }
+    else {
+      setStatus(status, 128 + WTERMSIG(procs->waitResults));
+    }
+  }
+
+  if(interruptReceived) {
+    setStatus(status, 128 + SIGINT);
+  }
+}
+
+
+/*******************************************************************************
+ *                           signalNames
+ * The signals kill knows by name, without their "SIG"
+*******************************************************************************/
+typedef struct SignalName {
+  char* name;
+  int number;
+} signalName;
+
+signalName signalNames[] = {
+  {"HUP", SIGHUP}, {"INT", SIGINT}, {"QUIT", SIGQUIT}, {"ABRT", SIGABRT},
+  {"KILL", SIGKILL}, {"USR1", SIGUSR1}, {"SEGV", SIGSEGV}, {"USR2", SIGUSR2},
+  {"PIPE", SIGPIPE}, {"ALRM", SIGALRM}, {"TERM", SIGTERM}, {"CHLD", SIGCHLD},
+  {"CONT", SIGCONT}, {"STOP", SIGSTOP}, {"TSTP", SIGTSTP}, {"TTIN", SIGTTIN},
+  {"TTOU", SIGTTOU}, {"WINCH", SIGWINCH}, {NULL, 0}
+};
+
+
+/*******************************************************************************
+ *                   int signalNumber(char* name)
+ * Description: reads a signal given to kill as a number, or a name with or
+ *   without "SIG"
+ * Output: the signal, or -1 if it is not one
+*******************************************************************************/
+int signalNumber(char* name) {
+  char* end;
+  int i;
+  if(name == NULL) {
+    return -1;
+  }
+  if(isdigit((unsigned char)name[0])) {
+    long number = strtol(name, &end, 10);
+    return *end == '\0' && number < NSIG ? (int)number : -1;
+  }
+  if(strncmp(name, "SIG", 3) == 0) {
+    name += 3;
+  }
+  for(i = 0; signalNames[i].name != NULL; ++i) {
+    if(strcmp(signalNames[i].name, name) == 0) {
+      return signalNames[i].number;
+    }
+  }
+  return -1;
+}
+
+void killCommand(char** args, processes* procs, result* status) {
+  int sig = SIGTERM;
+  int failed = FALSE;
+  int signalledShell = FALSE;
+  int i = 1;
+
+  if(args[1] != NULL && strcmp(args[1], "-l") == 0) {
+    for(i = 0; signalNames[i].name != NULL; ++i) {
+      printf("%d %s\n", signalNames[i].number, signalNames[i].name);
+    }
+    flushOutput();
+    setStatus(status, 0);
+    return;
+  }
+  if(args[1] != NULL && strcmp(args[1], "-s") == 0) {
+    sig = signalNumber(args[2]);
+    i = args[2] != NULL ? 3 : 2;
+  }
+  else if(args[1] != NULL && args[1][0] == '-' && args[1][1] != '-' &&
+          args[1][1] != '\0') {
+    sig = signalNumber(args[1] + 1);
+    i = 2;
+  }
+  if(args[i] != NULL && strcmp(args[i], "--") == 0) {
+    i++;
+  }
+  if(sig == -1) {
+    builtinError("kill: %s: invalid signal\n", args[i - 1]);
+    setStatus(status, 1);
+    return;
+  }
+  if(args[i] == NULL) {
+    builtinError("kill: usage: kill [-s SIGNAL | -SIGNAL] %%N | pid ...\n");
+    setStatus(status, 1);
+    return;
+  }
+
+  for(; args[i] != NULL; ++i) {
+    if(args[i][0] == '%') {
+      int index = findJob(procs, args[i]);
+      if(index == -1) {
+        builtinError("kill: %s: no such job\n", args[i]);
+        failed = TRUE;
+        continue;
+      }
+      int pgid = procs->jobs[index].pgid;
+      kill(-pgid, sig);
+      if(jobStopped(procs, index) && sig != 0 && sig != SIGCONT &&
+         sig != SIGSTOP && sig != SIGTSTP && sig != SIGTTIN && sig != SIGTTOU) {
+        kill(-pgid, SIGCONT);
       }
+      continue;
     }
 
-    /* if args at examine index is '>', then set file redirection output */
-    else if (strcmp(args[examineIndex], ">") == 0) {
-      if(isWord(args[examineIndex + 1])) {
-        /* then examineIndex + 1 is the name of a file for file output 
-           redirection. Set the flag and save the file name*/
-        outputRedirectionFlag = 1;
-        memset(outputRedirectionFileName, '\0', ARBITRARY_MAX_WORD_LENGTH);
-        strcpy(outputRedirectionFileName, args[examineIndex + 1]);
-
-        /* rearrange current working indecies */
-        examineIndex += 2;
-      }
-      /* if the next argument is not a minimally valid word, then we will treat
-         this special character as a regular argument. */
-      else {
-        argsFilterDown(args, &actualIndex, &examineIndex);
-      }
+    char* end;
+    int pid = (int)strtol(args[i], &end, 10);
+    if(*end != '\0' || end == args[i]) {
+      builtinError("kill: %s: arguments must be process or job IDs\n",
+                   args[i]);
+      failed = TRUE;
     }
-    /* replace && with pid number */
-    else if (strcmp(args[examineIndex], "$$") == 0) {
-      char* pidString = malloc(sizeof(char) * 12);
-      memset(pidString, '\0', 12);
-      sprintf(pidString, "%d", getpid());
-      free(args[examineIndex]);
-      args[examineIndex] = pidString;
+    else if(kill(pid, sig) == -1) {
+      builtinError("kill: (%s) - %s\n", args[i], strerror(errno));
+      failed = TRUE;
     }
+    else if(pid == getpid() || pid == -getpgrp() || pid == 0 || pid == -1) {
+      signalledShell = TRUE;
+    }
+  }
 
-    /* if args at examine index is '&', then set background flag */
-    else if (strcmp(args[examineIndex], "&") == 0) {
-      /* if the & is the last argument, set the background flag */
-      if(args[examineIndex + 1] == NULL) {
-        backgroundFlag = TRUE;
-        if(background_allowed == FALSE) {
-          backgroundFlag = FALSE;
-        }
-        examineIndex += 1;
-      }
-      /* if it isn't the last argument, treat it like a normal argument */
-      else {
-        argsFilterDown(args, &actualIndex, &examineIndex);
-      }
+  /* a signal sent to the shell is handled before the next command runs, just
+     as it would have been while waiting for a kill program */
+  if(signalledShell) {
+    handleEvents(0);
+  }
+  setStatus(status, failed ? 1 : 0);
+}
+
+
+/*******************************************************************************
+ *                         BUILTINS, builtinTable
+ * The built-in commands, in a hash table that is laid out by the compiler.
+ * BUILTIN_SLOT is a perfect hash of the names: it gives each of them a
+ * different slot, so finding a built-in costs one hash and one strcmp however
+ * many there are. A name's slot is worked out from its length, its first two
+ * characters and its last character, which BUILTINS spells out beside the
+ * name, since the compiler cannot take them from the string.
+ * builtinTable is generated from BUILTINS, and so is the switch in
+ * builtinSlotsDistinct, which is never called: two names landing in one slot
+ * are two equal case labels there, which is always a compile error, in which
+ * case the multipliers in BUILTIN_SLOT need to be chosen again. That the
+ * characters spelled out are the name's own is checked when the first name
+ * is looked up (see checkBuiltinTable).
+*******************************************************************************/
+#define BUILTIN_SLOT(length, first, second, last) \
+  (((length) + 2 * (first) + 11 * (second) + 12 * (last)) & \
+   (BUILTIN_TABLE_SIZE - 1))
+
+#define BUILTINS(X) \
+  X(2, 'c', 'd', 'd', "cd", cdCommand, FALSE) \
+  X(6, 's', 't', 's', "status", statusCommand, FALSE) \
+  X(4, 'e', 'x', 't', "exit", exitCommand, FALSE) \
+  X(4, 'h', 'a', 'h', "hash", hashCommand, FALSE) \
+  X(6, 'r', 'e', 'h', "rehash", rehashCommand, FALSE) \
+  X(10, 'j', 'o', 't', "jobs-limit", jobsLimitCommand, FALSE) \
+  X(6, 'e', 'x', 't', "export", exportCommand, FALSE) \
+  X(5, 's', 't', 's', "stats", statsCommand, FALSE) \
+  X(7, 'h', 'i', 'y', "history", historyCommand, FALSE) \
+  X(4, 'e', 'c', 'o', "echo", echoCommand, TRUE) \
+  X(4, 't', 'r', 'e', "true", trueCommand, TRUE) \
+  X(5, 'f', 'a', 'e', "false", falseCommand, TRUE) \
+  X(4, 't', 'e', 't', "test", testCommand, TRUE) \
+  X(1, '[', '\0', '[', "[", testCommand, TRUE) \
+  X(6, 'p', 'r', 'f', "printf", printfCommand, TRUE) \
+  X(4, 'j', 'o', 's', "jobs", jobsCommand, FALSE) \
+  X(2, 'f', 'g', 'g', "fg", fgCommand, FALSE) \
+  X(2, 'b', 'g', 'g', "bg", bgCommand, FALSE) \
+  X(4, 'w', 'a', 't', "wait", waitCommand, FALSE) \
+  X(4, 'k', 'i', 'l', "kill", killCommand, FALSE) \
+  X(5, 'p', 'l', 'e', "place", placeCommand, FALSE) \
+  X(7, 'c', 'a', 'e', "capture", captureCommand, FALSE)
+
+#define BUILTIN_ENTRY(length, first, second, last, name, handler, external) \
+  [BUILTIN_SLOT(length, first, second, last)] = {name, handler, external},
+#define BUILTIN_CASE(length, first, second, last, name, handler, external) \
+  case BUILTIN_SLOT(length, first, second, last):
+
+builtin builtinTable[BUILTIN_TABLE_SIZE] = {
+  BUILTINS(BUILTIN_ENTRY)
+};
+int builtinTableChecked = FALSE;
+
+void builtinSlotsDistinct(int slot) {
+  switch(slot) {
+    BUILTINS(BUILTIN_CASE)
+    default:
+      break;
+  }
+}
+
+
+/*******************************************************************************
+ *                       int builtinSlot(char* name)
+ * Description: the slot of builtinTable a non-empty name hashes to
+*******************************************************************************/
+int builtinSlot(char* name) {
+  size_t length = strlen(name);
+  return BUILTIN_SLOT((int)length, name[0], name[1], name[length - 1]);
+}
+
+
+/*******************************************************************************
+ *                        void checkBuiltinTable()
+ * Description: makes sure every built-in sits in the slot its name hashes
+ *   to, which it does not if BUILTINS spells the name's characters wrong. This
+ *   is checked in every build, not with assert.
+*******************************************************************************/
+void checkBuiltinTable() {
+  int i;
+  for(i = 0; i < BUILTIN_TABLE_SIZE; ++i) {
+    if(builtinTable[i].name != NULL && builtinSlot(builtinTable[i].name) != i) {
+      fprintf(stderr, "smallsh: built-in %s is not in its slot\n",
+              builtinTable[i].name);
+      abort();
     }
+  }
+  builtinTableChecked = TRUE;
+}
 
-    /* else, the current argument being analyzed should be treated as a regular
-       argument. Filter it down to its spot in args */
+
+/*******************************************************************************
+ *                     builtin* findBuiltin(char* name)
+ * Description: looks a command name up in builtinTable
+ * Output: the built-in, or NULL if name is not one
+*******************************************************************************/
+builtin* findBuiltin(char* name) {
+  if(name == NULL || name[0] == '\0') {
+    return NULL;
+  }
+  if(!builtinTableChecked) {
+    checkBuiltinTable();
+  }
+  builtin* command = &builtinTable[builtinSlot(name)];
+  if(command->name == NULL || strcmp(command->name, name) != 0) {
+    return NULL;
+  }
+  return command;
+}
+
+
+/*******************************************************************************
+ *                   int isAssignmentLine(command* cmd)
+ * Description: decides whether every word of the line has the form NAME=value
+*******************************************************************************/
+int isAssignmentLine(command* cmd) {
+  char** args = cmd->args;
+  if(args[0] == NULL || cmd->numStages > 1) {
+    return FALSE;
+  }
+  int i;
+  for(i = 0; args[i] != NULL; ++i) {
+    if(!isAssignment(args[i])) {
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+
+
+/*******************************************************************************
+ *           void runBuiltin(builtin* builtinCommand, command* cmd,
+ *                           processes* procs, result* status)
+ * Description: runs a built-in inside the shell. When the command redirects
+ *   its output or its standard error, the shell's own are moved aside while
+ *   the built-in runs and put back afterwards. A file named with < must
+ *   exist, but built-ins do not read their input.
+*******************************************************************************/
+void runBuiltin(builtin* builtinCommand, command* cmd, processes* procs,
+                result* status) {
+  int inputFile;
+  int outputFile;
+  int errorFile;
+
+  if(!cmd->inputRedirectionFlag && !cmd->outputRedirectionFlag &&
+     !cmd->errorRedirectionFlag && !cmd->errorToOutputFlag) {
+    builtinCommand->handler(cmd->args, procs, status);
+    return;
+  }
+  if(!openRedirections(cmd, &inputFile, &outputFile, &errorFile)) {
+    setStatus(status, 1);
+    return;
+  }
+
+  fflush(stdout);
+  int savedOutput = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 3);
+  int savedError = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 3);
+  if(outputFile != -1) {
+    dup2(outputFile, STDOUT_FILENO);
+  }
+  if(errorFile != -1) {
+    dup2(errorFile == ERROR_TO_OUTPUT ? STDOUT_FILENO : errorFile,
+         STDERR_FILENO);
+  }
+
+  builtinCommand->handler(cmd->args, procs, status);
+
+  fflush(stdout);
+  dup2(savedOutput, STDOUT_FILENO);
+  dup2(savedError, STDERR_FILENO);
+  close(savedOutput);
+  close(savedError);
+  closeRedirection(inputFile);
+  closeRedirection(outputFile);
+  if(errorFile != ERROR_TO_OUTPUT) {
+    closeRedirection(errorFile);
+  }
+}
+
+/*******************************************************************************
+ *         void timeBuiltin(builtin* builtinCommand, command* cmd,
+ *                          processes* procs, result* status)
+ * Description: runs a built-in prefixed with "time" and reports its times
+ *   as printTimes does for a program: the wall time, the CPU time the shell
+ *   used while it ran and the shell's maximum resident set size
+*******************************************************************************/
+void timeBuiltin(builtin* builtinCommand, command* cmd, processes* procs,
+                 result* status) {
+  struct timespec started;
+  struct timespec ended;
+  struct rusage before;
+  struct rusage usage;
+  clock_gettime(CLOCK_MONOTONIC, &started);
+  getrusage(RUSAGE_SELF, &before);
+
+  runBuiltin(builtinCommand, cmd, procs, status);
+
+  clock_gettime(CLOCK_MONOTONIC, &ended);
+  getrusage(RUSAGE_SELF, &usage);
+  timersub(&usage.ru_utime, &before.ru_utime, &usage.ru_utime);
+  timersub(&usage.ru_stime, &before.ru_stime, &usage.ru_stime);
+  printTimes(&started, &ended, &usage);
+  printf("\n");
+  flushOutput();
+}
+
+
+/*******************************************************************************
+ *   void runCommand(command* cmd, builtin* builtinCommand, processes* procs,
+ *                   result* status)
+ * Description: runs a parsed line. Blank lines and comments do nothing, a
+ *   line made up only of NAME=value words sets shell variables, a built-in
+ *   (builtinCommand, NULL if it is not one) runs inside the shell and
+ *   anything else is run as processes. An external built-in that is run in
+ *   the background, timed or limited is run as a process too. Any other
+ *   built-in prefixed with "time" is timed inside the shell.
+*******************************************************************************/
+void runCommand(command* cmd, builtin* builtinCommand, processes* procs,
+                result* status) {
+  struct timespec traceBegan;
+
+  /* whether a '&' is honoured depends on the mode the shell is in now */
+  cmd->backgroundFlag = cmd->backgroundRequested && background_allowed;
+
+  if(cmd->args[0] == NULL || cmd->args[0][0] == '#') {
+    /* nothing to do */
+  }
+  else if(isAssignmentLine(cmd)) {
+    assignVariables(cmd->args);
+  }
+  else if(builtinCommand != NULL &&
+          !(builtinCommand->external &&
+            (cmd->backgroundFlag || cmd->timeFlag || cmd->limits.set))) {
+    traceClock(&traceBegan);
+    if(cmd->timeFlag) {
+      timeBuiltin(builtinCommand, cmd, procs, status);
+    }
     else {
-      /* search for '$$' in the string, and replace it with the pid if it is there */
-      replaceDoubleDollars(&args[examineIndex]);
-      argsFilterDown(args, &actualIndex, &examineIndex);
+      runBuiltin(builtinCommand, cmd, procs, status);
     }
+    traceEvent(builtinCommand->name, &traceBegan);
   }
-  if(args[actualIndex] != NULL) {
-    free(args[actualIndex]);
+  else {
+    spawnProcess(cmd, procs, status);
   }
-  args[actualIndex] = NULL;
 }
 
 
 /*******************************************************************************
- *                        void resetFlags()
- * resets the input, output, and background flags
+ *                              struct Block
+ * A block runs the lines between its header and a line holding only "}" over
+ * and over:
+ *   - repeat N {        - N times
+ *   - for NAME in ... { - once for each of the words, with NAME set to it
+ *   - while COMMAND {   - for as long as COMMAND exits with 0
+ * Blocks can be nested. The whole block is read before it runs, and each
+ * line (and the condition of a while) is parsed once, into a blockLine: a
+ * line that isCacheable is parsed completely and run as it is every time,
+ * any other line is only split into words, and each time it runs a copy is
+ * parsed so that only its expansions are done again. The words of a repeat
+ * or for header are expanded once, when the block is read. A SIGINT stops
+ * every block that is running.
+*******************************************************************************/
+typedef struct BlockLine {
+  command parsed;
+  int expanded;
+  builtin* builtinCommand;
+  struct Block* inner;
+} blockLine;
+
+typedef struct Block {
+  int kind;
+  long count;
+  command header;
+  blockLine condition;
+  blockLine* lines;
+  int numLines;
+  int capacity;
+} block;
+
+command blockCommand;
+
+
+/*******************************************************************************
+ *                       int isBlockStart(char* line)
+ * Description: decides whether a line is the header of a block: it begins with
+ *   "repeat", "for" or "while" and ends with a "{" word
 *******************************************************************************/
-void resetFlags() {
-  inputRedirectionFlag = 0;
-  outputRedirectionFlag = 0;
-  backgroundFlag = 0;
+int isBlockStart(char* line) {
+  char* start = line + strspn(line, " \t");
+  size_t length = strcspn(start, " \t");
+  if(!((length == 6 && strncmp(start, "repeat", 6) == 0) ||
+       (length == 3 && strncmp(start, "for", 3) == 0) ||
+       (length == 5 && strncmp(start, "while", 5) == 0))) {
+    return FALSE;
+  }
+  char* end = start + strlen(start);
+  while(end > start && (end[-1] == ' ' || end[-1] == '\t')) {
+    end--;
+  }
+  return end - start > 2 && end[-1] == '{' &&
+         (end[-2] == ' ' || end[-2] == '\t');
 }
 
 
 /*******************************************************************************
- *                       void changeDirectory(char* path)
- * Changes the directory to the path name specified
+ *             void blockLineParse(blockLine* line, char* text,
+ *                                 result* status, processes* procs)
+ * Description: parses a line of a block as far as it can be before it runs
 *******************************************************************************/
-void changeDirectory(char* path) {
-  if(path == NULL) {
-    chdir(getenv("HOME"));
+void blockLineParse(blockLine* line, char* text, result* status,
+                    processes* procs) {
+  initializeCommand(&line->parsed, INITIAL_NUMBER_ARGS);
+  line->inner = NULL;
+  line->builtinCommand = NULL;
+  line->expanded = isCacheable(text);
+  if(line->expanded) {
+    parseLine(text, &line->parsed, status, procs);
+    if(line->parsed.numStages == 1) {
+      line->builtinCommand = findBuiltin(line->parsed.args[0]);
+    }
   }
   else {
-    chdir(path);
+    getArgs(text, &line->parsed);
   }
 }
 
 
 /*******************************************************************************
- *                         struct Results
- * A struct to hold the code and a boolean value indicating whether the previous
- * process was terminated by signal or not
+ *       void blockLineRun(blockLine* line, result* status, processes* procs)
+ * Description: runs a line of a block, finishing its parse in blockCommand
+ *   first if it has expansions
 *******************************************************************************/
-typedef struct Results {
-  int code;
-  int sig;
-} result;
+void blockLineRun(blockLine* line, result* status, processes* procs) {
+  if(line->expanded) {
+    runCommand(&line->parsed, line->builtinCommand, procs, status);
+    return;
+  }
+  if(blockCommand.args == NULL) {
+    initializeCommand(&blockCommand, INITIAL_NUMBER_ARGS);
+  }
+  copyCommand(&line->parsed, &blockCommand);
+  parseArgs(&blockCommand, status, procs);
+  builtin* builtinCommand = NULL;
+  if(blockCommand.numStages == 1) {
+    builtinCommand = findBuiltin(blockCommand.args[0]);
+  }
+  runCommand(&blockCommand, builtinCommand, procs, status);
+}
 
 
 /*******************************************************************************
- *                        void spawnProcess(args)
- * Description: spawns a new process via fork(), then sets the appropriate file
- *   handlers if the relevent flags are set and then calls exec(), calling the
- *   new process
- * Input: list of arguments
- * Output: none
+ *                     void destroyBlock(block* loop)
+ * Description: frees a block and the blocks inside it
 *******************************************************************************/
-void spawnProcess(char** args, processes* procs, result* status) {
-  assert(args != NULL);
-  int results = 0;
-  int outputFile;
-  int inputFile;
+void destroyBlock(block* loop) {
+  int i;
+  for(i = 0; i < loop->numLines; ++i) {
+    if(loop->lines[i].inner != NULL) {
+      destroyBlock(loop->lines[i].inner);
+    }
+    else {
+      destroyCommand(&loop->lines[i].parsed);
+    }
+  }
+  if(loop->kind == BLOCK_WHILE) {
+    destroyCommand(&loop->condition.parsed);
+  }
+  destroyCommand(&loop->header);
+  free(loop->lines);
+  free(loop);
+}
 
-  /* create a copy of the current process */
-  int pid = fork();
 
-  switch (pid) {
-    /* pid is -1, error */
-    case -1:
-      perror("fork() failed.\n");
-      break;
+/*******************************************************************************
+ *     block* readBlock(char* headerLine, processes* procs, result* status)
+ * Description: reads the lines of the block that headerLine begins, up to its
+ *   "}", from the input. The header is checked once the whole block has been
+ *   read, so that the lines of a block with a mistake in its header are
+ *   skipped rather than run. A block inside it that cannot be run makes the
+ *   whole block fail too, but only once its "}" has been read, so that none
+ *   of its remaining lines are run at the top level.
+ * Output: the block, or NULL if it cannot be run
+*******************************************************************************/
+block* readBlock(char* headerLine, processes* procs, result* status) {
+  block* loop = malloc(sizeof(block));
+  assert(loop != NULL);
+  loop->count = 0;
+  loop->lines = NULL;
+  loop->numLines = 0;
+  loop->capacity = 0;
+  initializeCommand(&loop->header, INITIAL_NUMBER_ARGS);
+  parseLine(headerLine, &loop->header, status, procs);
 
-    /* pid is 0, child process */
-    case 0:
-      /* set the child process to ignore SIGTSTP interrupts */
-      signal(SIGTSTP, SIG_IGN);
+  char** args = loop->header.args;
+  int numWords = 0;
+  while(args[numWords] != NULL) {
+    numWords++;
+  }
+  char* error = NULL;
+  int innerFailed = FALSE;
+  if(strcmp(args[0], "repeat") == 0) {
+    char* end;
+    loop->kind = BLOCK_REPEAT;
+    loop->count = numWords == 3 ? strtol(args[1], &end, 10) : -1;
+    if(numWords != 3 || *end != '\0' || loop->count < 0) {
+      error = "repeat: usage: repeat N {";
+    }
+  }
+  else if(strcmp(args[0], "for") == 0) {
+    loop->kind = BLOCK_FOR;
+    loop->count = numWords - 4;
+    if(numWords < 4 || strcmp(args[2], "in") != 0 ||
+       variableNameLength(args[1]) != (int)strlen(args[1])) {
+      error = "for: usage: for NAME in WORD... {";
+    }
+  }
+  else {
+    /* the condition is everything between "while" and "{", unexpanded */
+    loop->kind = BLOCK_WHILE;
+    char* condition = strdup(headerLine + strspn(headerLine, " \t") + 5);
+    assert(condition != NULL);
+    *strrchr(condition, '{') = '\0';
+    blockLineParse(&loop->condition, condition, status, procs);
+    free(condition);
+    if(loop->condition.parsed.args[0] == NULL) {
+      error = "while: usage: while COMMAND {";
+    }
+  }
 
-      /* set file redirection if flags are set */
-      /* set input redirection */
-      if(inputRedirectionFlag) {
-        inputFile = open(inputRedirectionFileName, O_RDONLY);
-        
-        /* print error messages and exit child process if file redirection 
-           is invalid */
-        if(inputFile == -1) {
-          printf("cannot open %s for input\n", inputRedirectionFileName);
-          fflush(stdout);
-          exit(1);
-        }
-        dup2(inputFile, 0);
-      }
-      else if(backgroundFlag) {
-        inputFile = open("/dev/null", O_RDONLY);
-        dup2(inputFile, 0);
-      }
+  while(TRUE) {
+    command* parsed;
+    char* text = prompt(procs, &parsed);
+    if(text == NULL) {
+      error = "smallsh: the input ended inside a block";
+      break;
+    }
+    char* word = text + strspn(text, " \t");
+    if(word[0] == '}' && word[1 + strspn(word + 1, " \t")] == '\0') {
+      break;
+    }
 
-      /* set output redirection */
-      if(outputRedirectionFlag) {
-        outputFile = open(outputRedirectionFileName, O_WRONLY | O_CREAT | O_TRUNC, 0666);
-        dup2(outputFile, 1);
-      }
-      else if(backgroundFlag) {
-        outputFile = open("/dev/null", O_WRONLY | O_CREAT, 0666);
-        dup2(outputFile, 1);
+    if(loop->numLines == loop->capacity) {
+      loop->capacity = loop->capacity == 0 ? 8 : loop->capacity * 2;
+      loop->lines = realloc(loop->lines, sizeof(blockLine) * loop->capacity);
+      assert(loop->lines != NULL);
+    }
+    blockLine* line = &loop->lines[loop->numLines];
+    if(isBlockStart(text)) {
+      line->inner = readBlock(text, procs, status);
+      if(line->inner == NULL) {
+        innerFailed = TRUE;
+        continue;
       }
+    }
+    else {
+      blockLineParse(line, text, status, procs);
+    }
+    loop->numLines += 1;
+  }
 
-      /* call exec to execute other program, preserving file redirection */
-      if(execvp(args[0], args) == -1) {
-        char errorString[100];
-        memset(errorString, '\0', 100);
-        strcpy(errorString, strerror(errno));
-        errorString[0] += 32;
-        printf("%s: %s\n", args[0], errorString);
-        fflush(stdout);
-        exit(1);
-      }
-      
-    /* pid is a valid pid of the child process */
-    /* this is the parent */
-    default:
-      /* call waitpid() if the background flag is not set. Otherwise resume
-         normal operation */
-      if(backgroundFlag) {
-        printf("background pid is %d\n", pid);
-        fflush(stdout);
-        processesAdd(procs, pid);
-      }
-      else {
-        /* set and unset flags to prevent signal handler output during waitpid()
-           blocking */
-        foregroundProcessRunning = TRUE;
-        waitpid(pid, &results, 0);
-        foregroundProcessRunning = FALSE;
-
-        /* get the status of the terminated process */
-        if (WIFEXITED(results) != 0) {
-          status->sig = FALSE;
-          status->code = WEXITSTATUS(results);
-        }  
-        else if(WIFSIGNALED(results) != 0) {
-          status->sig = TRUE;
-          status->code = WTERMSIG(results);
-          printf("terminated by signal %d\n", status->code);
-          fflush(stdout);
-        }
-      }
-      break;
-  };
+  if(error != NULL || innerFailed) {
+    if(error != NULL) {
+      printf("%s\n", error);
+      flushOutput();
+    }
+    destroyBlock(loop);
+    return NULL;
+  }
+  return loop;
 }
-  
+
 
 /*******************************************************************************
- *                          void cleanupProcs(procs)
- * Iterates through the processes struct dynamic array and checks if the
- * processes therin have completed. If they have, a message is printed to 
- * stdout
- * Input:
- *   processes* pointer to processes struct
- * Output:
- *   return: none
- *   processes struct is modified as processes terminate
- *   messages are printed to the screen
+ *        void runBlock(block* loop, processes* procs, result* status)
+ * Description: runs the lines of a block for as long as it says, stopping if
+ *   a SIGINT is received. The events are checked before every iteration and
+ *   every line, since a body of built-ins never waits in the event loop and
+ *   would not otherwise see the SIGINT or reap its background jobs.
 *******************************************************************************/
-void cleanupProcs(processes* procs) {
+void runBlock(block* loop, processes* procs, result* status) {
+  long iteration;
   int i;
-  int results;
-  int pid;
-  int signal;
-  int code;
-
-  /* iterate through the processes dynamic array */
-  for(i = 0; i < procs->size; ++i) {
-    /* check the status of each without blocking */
-    pid = waitpid(procs->array[i], &results, WNOHANG);
-    /* if the bg process terminated since the last check,
-       check the exit status */
-    if(pid > 0) {
-      /* get the exit status */
-      if (WIFEXITED(results) != 0) {
-        signal = FALSE;
-        code = WEXITSTATUS(results);
-      }
-      else if (WIFSIGNALED(results) != 0) {
-        signal = TRUE;
-        code = WTERMSIG(results);
+  for(iteration = 0; TRUE; ++iteration) {
+    handleEvents(0);
+    cleanupProcs(procs);
+    if(interruptReceived) {
+      break;
+    }
+    if(loop->kind != BLOCK_WHILE && iteration >= loop->count) {
+      break;
+    }
+    if(loop->kind == BLOCK_FOR) {
+      setVariable(loop->header.args[1], loop->header.args[3 + iteration],
+                  FALSE);
+    }
+    if(loop->kind == BLOCK_WHILE) {
+      blockLineRun(&loop->condition, status, procs);
+      if(status->sig || status->code != 0 || interruptReceived) {
+        break;
       }
+    }
 
-      /* and display the results */
-      printf("background pid %d is done: ", pid);
-      if(signal) {
-        printf("terminated by signal %d\n", code);
+    for(i = 0; i < loop->numLines; ++i) {
+      handleEvents(0);
+      cleanupProcs(procs);
+      if(interruptReceived) {
+        break;
+      }
+      if(loop->lines[i].inner != NULL) {
+        runBlock(loop->lines[i].inner, procs, status);
       }
       else {
-        printf("exit value %d\n", code);
+        blockLineRun(&loop->lines[i], status, procs);
       }
-      fflush(stdout);
-
-      /* remove the process from the processes array */
-      processesRemove(procs, pid);
-      /* decrement i to account for the recuction in size and altered
-         placement of items in the dynamic array */
-      i--;
     }
   }
 }
 
 
+#ifndef SMALLSH_NO_MAIN
 /*******************************************************************************
  *                          int main()
  * Description: begins the execution of smallsh
- * Input: none
+ * Input: the options described in openInput
  * Output: int - exit status
 *******************************************************************************/
-int main() {
+int main(int argc, char** argv) {
   /* initialize variables and structs */
   char* promptInput = NULL;                /*char* to hold prompt input args */
-  size_t inputBuffer = MAX_INPUT_SIZE;     /*size of maximum allowed input */
   int pid = getpid();                      /*pid of current smallsh process*/
-  result status;                   /*empty results struct*/
+  result status = {0, FALSE};              /*empty results struct*/
   processes* procs = createProcessArray(); /*dyn array of bg processes */
-  char** args = initializeArgs();          /*initialize array of arguments */
+  initializeCommand(&lineCommand, INITIAL_NUMBER_ARGS);
 
 
-  /* sets the interrupt handlers for smallsh */
+  /* sets the interrupt handlers for smallsh and reads its settings */
   setInterrupts();
+  loadSettings();
+  openInput(argc, argv);
 
-  /* display the pid of smallsh */
-  printf("shallsh pid: %d\n", pid);
-  fflush(stdout);
+  /* display the pid of smallsh, unless asked to be quiet */
+  if(!quiet) {
+    printf("shallsh pid: %d\n", pid);
+    flushOutput();
+  }
 
   while(TRUE){
-    /* look for terminated bg processes and display termination info for them */
-    cleanupProcs(procs);
-    /* display a prompt and collect input and process the input */
-    prompt(&promptInput, inputBuffer);
-    getArgs(promptInput, args);
-    parseArgs(args);
-    int commandCode = isBuiltIn(args[0]);
-
-    /* switch to execute the proper command */
-    switch(commandCode) {
-      /* if the first arg was cd, call change directory with the path */
-      case CD_CODE:
-        changeDirectory(args[1]);
-        break;
-
-      /* if the code was status, display the exit code of the most recently term
-         inated fg process */
-      case STATUS_CODE:
-        if(status.sig == FALSE) {
-          printf("exit value %d\n", status.code);
-          fflush(stdout);
-        }
-        else {
-          printf("terminated by signal %d\n", status.code);
-          fflush(stdout);
-        }
-        break;
+    /* display a prompt and collect input and process the input. prompt also
+       displays termination info for terminated bg processes */
+    command* cmd = NULL;
+    struct timespec traceBegan;
+    traceClock(&traceBegan);
+    promptInput = prompt(procs, &cmd);
+    traceEvent("prompt", &traceBegan);
+    /* the end of the input is treated the same as exit. other lines are
+       looked up in and added to the history */
+    if(promptInput == NULL) {
+      promptInput = "exit";
+    }
+    else {
+      promptInput = historyExpand(promptInput);
+      if(promptInput == NULL) {
+        continue;
+      }
+      historyAdd(promptInput);
+    }
 
-      /* if exit was the argument, clean up the program and exit */
-      case EXIT_CODE:
-        free(promptInput);
-        destroyArgs(args);
-        destroyProcessArray(procs);
-        exit(0);
-        break;
-  
-      /* if the command was a comment, do nothing */
-      case COMMENT_CODE:
-        break;
+    /* a block is read to its end and then run */
+    if(isBlockStart(promptInput)) {
+      block* loop = readBlock(promptInput, procs, &status);
+      if(loop != NULL) {
+        interruptReceived = FALSE;
+        runBlock(loop, procs, &status);
+        destroyBlock(loop);
+      }
+      continue;
+    }
 
-      /* if it was none of these then spawn a new process to attempt to execute
-         the command*/
-      default:
-        spawnProcess(args, procs, &status);
-        break;
+    /* a line seen recently runs the command in the cache. other lines are
+       parsed into lineCommand unless they were parsed ahead, and cached. any
+       pipeline is run as processes, even if it begins with a built-in */
+    builtin* builtinCommand = NULL;
+    traceClock(&traceBegan);
+    parsedLine* cached = parseCacheFind(promptInput);
+    if(cached != NULL) {
+      cmd = &cached->parsed;
+      builtinCommand = cached->builtinCommand;
+    }
+    else {
+      if(cmd == NULL) {
+        cmd = &lineCommand;
+        parseLine(promptInput, cmd, &status, procs);
+      }
+      if(cmd->numStages == 1) {
+        builtinCommand = findBuiltin(cmd->args[0]);
+      }
+      parseCacheStore(promptInput, cmd, builtinCommand);
+    }
+    traceEvent("parse", &traceBegan);
 
-    };
-    /* reset the flags at the end of every loop */
-    resetFlags();
+    runCommand(cmd, builtinCommand, procs, &status);
   }
 }
+#endif
 
 
 /*******************************************************************************